@@ -2,16 +2,44 @@
 
 
 #include <cstdint>
+#include <cstddef>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <chrono>
+#include <deque>
 #include <vector>
+#include <stdexcept>
 #include <string>
+#include <fstream>
 #include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <thread>
+#include <typeinfo>
 #include <unordered_map>
+#include <type_traits>
+#include <utility>
 
 #include "strsafe.h"
 #include "windows.h"
 #include "Shellapi.h"
+#include <commctrl.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "comctl32.lib")
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define XRGUI_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace xrGUI{
 
@@ -22,11 +50,47 @@ void store(std::shared_ptr<Window> w);
 std::shared_ptr<Window> getWindowByHandle(HWND hTest);
 std::shared_ptr<Window> getWindowById(HMENU h);
 LRESULT handleWinMessage(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+LRESULT CALLBACK subclassWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam,
+    UINT_PTR subclassId, DWORD_PTR refData);
 
 // globals
+// id ranges released by destroyed WindowTrees, by span. Defined before the
+// window tables so it outlives trees they release during static destruction.
+std::unordered_map<int, std::vector<int>> freeStaticSlots;
 std::unordered_map <HMENU, std::shared_ptr<Window>> windowMap;
 int childId = 100;
 
+// Command ids of dynamically created windows stay below STATIC_ID_BASE. Each
+// WindowTree reserves its own range of ids in [STATIC_ID_BASE, STATIC_ID_END);
+// its controls get the range start plus the id in their descriptor and are
+// looked up by index in staticIdTable rather than through windowMap.
+constexpr int STATIC_ID_BASE = 0x4000;
+constexpr int STATIC_ID_END = 0x10000; // WM_COMMAND carries 16 bit ids
+constexpr int STATIC_ID_MAX = 0x3FFF;  // largest descriptor id
+std::vector<std::shared_ptr<Window>> staticIdTable;
+int nextStaticSlot = 0;
+
+// reserve span consecutive WindowTree ids, returning the offset of the
+// first from STATIC_ID_BASE
+int allocateStaticSlots(const int span) {
+    auto it = freeStaticSlots.find(span);
+    if (it != freeStaticSlots.end() && !it->second.empty()) {
+        const int base = it->second.back();
+        it->second.pop_back();
+        return base;
+    }
+    if (nextStaticSlot + span > STATIC_ID_END - STATIC_ID_BASE) {
+        throw std::length_error("xrGUI: WindowTree command id range exhausted");
+    }
+    const int base = nextStaticSlot;
+    nextStaticSlot += span;
+    return base;
+}
+
+void releaseStaticSlots(const int base, const int span) {
+    freeStaticSlots[span].push_back(base);
+}
+
 struct WinColor {
     uint8_t r;
     uint8_t g;
@@ -40,6 +104,12 @@ struct WinColor {
         ret |= (static_cast<COLORREF>(b) << 16);
         return ret;
     }
+    bool operator==(const WinColor& other) const {
+        return r == other.r && g == other.g && b == other.b;
+    }
+    bool operator!=(const WinColor& other) const {
+        return !(*this == other);
+    }
 };
 
 const auto RED = WinColor(255, 0, 0);
@@ -60,30 +130,504 @@ struct XYWH {
     int h;
 };
 
+// Signals.
+// A Signal is a multicast callback. Slots are stored in a slab indexed by
+// slot number, with small callables held inline so that connecting a
+// capturing lambda of up to SLOT_INLINE_SIZE bytes does not allocate.
+// connect() returns a Connection handle; connect and disconnect are O(1).
+// Emitting never allocates, and a signal allocates nothing until its first
+// connect.
+// Slots may be disconnected (including themselves) while the signal is
+// emitting; their storage is released once emission finishes. Slots
+// connected during emission are first called on the next emit.
+constexpr size_t SLOT_INLINE_SIZE = 4 * sizeof(void*);
+
+template <typename... Args>
+class SlotFunction {
+public:
+    SlotFunction() : invokeFn(nullptr), destroyFn(nullptr) {}
+    ~SlotFunction() {
+        reset();
+    }
+    SlotFunction(const SlotFunction&) = delete;
+    SlotFunction& operator=(const SlotFunction&) = delete;
+    template <typename F>
+    void assign(F&& f) {
+        using FT = typename std::decay<F>::type;
+        reset();
+        if (sizeof(FT) <= SLOT_INLINE_SIZE &&
+            alignof(FT) <= alignof(std::max_align_t)) {
+            new (storage) FT(std::forward<F>(f));
+            invokeFn = &invokeInline<FT>;
+            destroyFn = &destroyInline<FT>;
+        }
+        else {
+            *reinterpret_cast<FT**>(storage) = new FT(std::forward<F>(f));
+            invokeFn = &invokeHeap<FT>;
+            destroyFn = &destroyHeap<FT>;
+        }
+    }
+    void reset() {
+        if (destroyFn) {
+            destroyFn(storage);
+        }
+        invokeFn = nullptr;
+        destroyFn = nullptr;
+    }
+    void operator()(Args... args) {
+        invokeFn(storage, args...);
+    }
+private:
+    template <typename FT>
+    static void invokeInline(void* p, Args... args) {
+        (*static_cast<FT*>(p))(args...);
+    }
+    template <typename FT>
+    static void destroyInline(void* p) {
+        static_cast<FT*>(p)->~FT();
+    }
+    template <typename FT>
+    static void invokeHeap(void* p, Args... args) {
+        (**static_cast<FT**>(p))(args...);
+    }
+    template <typename FT>
+    static void destroyHeap(void* p) {
+        delete *static_cast<FT**>(p);
+    }
+    alignas(std::max_align_t) unsigned char storage[SLOT_INLINE_SIZE];
+    void (*invokeFn)(void*, Args...);
+    void (*destroyFn)(void*);
+};
+
+class SignalStateBase {
+public:
+    virtual ~SignalStateBase() {}
+    virtual void disconnect(uint32_t idx, uint32_t generation) = 0;
+    virtual bool connected(uint32_t idx, uint32_t generation) const = 0;
+};
+
+// lightweight handle to a connected slot; copying does not affect the slot
+class Connection {
+public:
+    Connection() : idx(0), generation(0) {}
+    Connection(std::weak_ptr<SignalStateBase> st, uint32_t i, uint32_t gen) :
+        state(st), idx(i), generation(gen)
+    {}
+    void disconnect() {
+        if (auto st = state.lock()) {
+            st->disconnect(idx, generation);
+        }
+        state.reset();
+    }
+    bool connected() const {
+        auto st = state.lock();
+        return st && st->connected(idx, generation);
+    }
+private:
+    std::weak_ptr<SignalStateBase> state;
+    uint32_t idx;
+    uint32_t generation;
+};
+
+// disconnects its slot when destroyed or reassigned
+class ScopedConnection {
+public:
+    ScopedConnection() {}
+    ScopedConnection(Connection c) : conn(c) {}
+    ScopedConnection(const ScopedConnection&) = delete;
+    ScopedConnection& operator=(const ScopedConnection&) = delete;
+    ScopedConnection(ScopedConnection&& other) : conn(other.release()) {}
+    ScopedConnection& operator=(ScopedConnection&& other) {
+        if (this != &other) {
+            conn.disconnect();
+            conn = other.release();
+        }
+        return *this;
+    }
+    ScopedConnection& operator=(Connection c) {
+        conn.disconnect();
+        conn = c;
+        return *this;
+    }
+    ~ScopedConnection() {
+        conn.disconnect();
+    }
+    void disconnect() {
+        conn.disconnect();
+    }
+    bool connected() const {
+        return conn.connected();
+    }
+    Connection release() {
+        Connection c = conn;
+        conn = Connection();
+        return c;
+    }
+private:
+    Connection conn;
+};
+
+// Callbacks that clear a handler rather than set one: nullptr, a null
+// function pointer or an empty std::function.
+template <typename F>
+bool isEmptyCallback(const F&) {
+    return false;
+}
+inline bool isEmptyCallback(std::nullptr_t) {
+    return true;
+}
+template <typename R, typename... A>
+bool isEmptyCallback(const std::function<R(A...)>& f) {
+    return !f;
+}
+template <typename R, typename... A>
+bool isEmptyCallback(R (*f)(A...)) {
+    return f == nullptr;
+}
+
+template <typename Sig>
+class Signal;
+
+template <typename... Args>
+class Signal<void(Args...)> {
+public:
+    Signal() {}
+    Signal(const Signal&) = delete;
+    Signal& operator=(const Signal&) = delete;
+    // connect f, or connect nothing and return an empty Connection if f is
+    // an empty callback; lets set*Callback(nullptr) clear a handler
+    Connection connectIfSet(std::nullptr_t) {
+        return Connection();
+    }
+    template <typename F>
+    Connection connectIfSet(F&& f) {
+        if (isEmptyCallback(f)) {
+            return Connection();
+        }
+        return connect(std::forward<F>(f));
+    }
+    template <typename F>
+    Connection connect(F&& f) {
+        if (!state) {
+            state = std::make_shared<State>();
+        }
+        State& s = *state;
+        // do not reuse slots mid-emission, they could be reached by the
+        // ongoing emit loop
+        const uint32_t idx = s.acquire(s.emitDepth == 0);
+        Slot& slot = s.at(idx);
+        slot.fn.assign(std::forward<F>(f));
+        slot.active = true;
+        s.count++;
+        return Connection(state, idx, slot.generation);
+    }
+    void emit(Args... args) {
+        if (!state) {
+            return;
+        }
+        // a slot may destroy the object owning this signal
+        std::shared_ptr<State> keep = state;
+        State& s = *keep;
+        s.emitDepth++;
+        const uint32_t n = s.used;
+        for (uint32_t k = 0; k < n; ++k) {
+            Slot& slot = s.at(k);
+            if (slot.active) {
+                slot.fn(args...);
+            }
+        }
+        s.emitDepth--;
+        if (s.emitDepth == 0 && s.deferredCount > 0) {
+            s.releaseDeferred();
+        }
+    }
+    void operator()(Args... args) {
+        emit(args...);
+    }
+    void disconnectAll() {
+        if (!state) {
+            return;
+        }
+        for (uint32_t k = 0; k < state->used; ++k) {
+            if (state->at(k).active) {
+                state->disconnect(k, state->at(k).generation);
+            }
+        }
+    }
+    size_t size() const {
+        return state ? state->count : 0;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+private:
+    static constexpr uint32_t SLOTS_PER_CHUNK = 8;
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    struct Slot {
+        Slot() : generation(0), nextFree(NO_SLOT), active(false), releasePending(false) {}
+        SlotFunction<Args...> fn;
+        uint32_t generation;
+        uint32_t nextFree;
+        bool active;
+        bool releasePending;
+    };
+    // Slots live in fixed size chunks, the first one inline, so their
+    // addresses stay stable while connecting mid-emission. Free slots are
+    // chained through nextFree.
+    struct State : public SignalStateBase {
+        State() : used(0), freeHead(NO_SLOT), emitDepth(0), count(0), deferredCount(0) {}
+        Slot& at(uint32_t idx) {
+            return idx < SLOTS_PER_CHUNK ? firstChunk[idx] :
+                chunks[idx / SLOTS_PER_CHUNK - 1][idx % SLOTS_PER_CHUNK];
+        }
+        uint32_t acquire(const bool reuse) {
+            if (reuse && freeHead != NO_SLOT) {
+                const uint32_t idx = freeHead;
+                freeHead = at(idx).nextFree;
+                return idx;
+            }
+            if (used == (chunks.size() + 1) * SLOTS_PER_CHUNK) {
+                chunks.emplace_back(new Slot[SLOTS_PER_CHUNK]);
+            }
+            return used++;
+        }
+        void disconnect(uint32_t idx, uint32_t gen) override {
+            if (!connected(idx, gen)) {
+                return;
+            }
+            Slot& slot = at(idx);
+            slot.active = false;
+            count--;
+            if (emitDepth > 0) {
+                slot.releasePending = true;
+                deferredCount++;
+            }
+            else {
+                release(idx);
+            }
+        }
+        bool connected(uint32_t idx, uint32_t gen) const override {
+            if (idx >= used) {
+                return false;
+            }
+            const Slot& slot = const_cast<State*>(this)->at(idx);
+            return slot.active && slot.generation == gen;
+        }
+        void release(uint32_t idx) {
+            Slot& slot = at(idx);
+            slot.fn.reset();
+            slot.generation++;
+            slot.releasePending = false;
+            slot.nextFree = freeHead;
+            freeHead = idx;
+        }
+        void releaseDeferred() {
+            for (uint32_t k = 0; k < used; ++k) {
+                if (at(k).releasePending) {
+                    release(k);
+                }
+            }
+            deferredCount = 0;
+        }
+        Slot firstChunk[SLOTS_PER_CHUNK];
+        std::vector<std::unique_ptr<Slot[]>> chunks;
+        uint32_t used;
+        uint32_t freeHead;
+        int emitDepth;
+        size_t count;
+        size_t deferredCount;
+    };
+    // created on first connect, so signals nobody listens to cost nothing
+    std::shared_ptr<State> state;
+};
+
+// Data binding.
+// An Observable holds a model value and a version counter which advances each
+// time the value actually changes. Controls bind to observables; a change only
+// queues the bindings attached to that observable, and flushBindings() (called
+// once per message pump iteration) applies each queued binding at most once.
+// The cost of a flush is therefore proportional to the number of changed
+// values, not the number of bound controls. Bindings are UI-thread only.
+class BindingBase {
+public:
+    BindingBase() : queued(false), active(true) {}
+    virtual ~BindingBase() {}
+    virtual void apply() = 0;
+    // stop applying; a detached binding may still sit in pendingBindings
+    // until the next flush but is skipped there
+    void detach() {
+        active = false;
+    }
+    bool queued;
+    bool active;
+};
+
+std::vector<std::shared_ptr<BindingBase>> pendingBindings;
+
+void queueBinding(const std::shared_ptr<BindingBase>& b) {
+    if (b->queued) {
+        return;
+    }
+    b->queued = true;
+    pendingBindings.push_back(b);
+}
+
+void flushBindings() {
+    if (pendingBindings.empty()) {
+        return;
+    }
+    // swap first so that a binding which changes another observable is
+    // applied on the next flush rather than invalidating this iteration
+    std::vector<std::shared_ptr<BindingBase>> batch;
+    batch.swap(pendingBindings);
+    for (auto& b : batch) {
+        b->queued = false;
+        if (b->active) {
+            b->apply();
+        }
+    }
+}
+
+template <typename T>
+class Observable {
+public:
+    Observable() : value(), version(0) {}
+    explicit Observable(const T& v) : value(v), version(1) {}
+    const T& get() const {
+        return value;
+    }
+    uint64_t getVersion() const {
+        return version;
+    }
+    void set(const T& v) {
+        if (value == v) {
+            return;
+        }
+        value = v;
+        touch();
+    }
+    // advance the version without comparing, e.g. after mutating in place
+    void touch() {
+        version++;
+        size_t live = 0;
+        for (size_t k = 0; k < bindings.size(); ++k) {
+            auto b = bindings[k].lock();
+            if (b && b->active) {
+                queueBinding(b);
+                bindings[live++] = bindings[k];
+            }
+        }
+        bindings.resize(live);
+    }
+    void attach(const std::shared_ptr<BindingBase>& b) {
+        bindings.push_back(b);
+    }
+private:
+    T value;
+    uint64_t version;
+    std::vector<std::weak_ptr<BindingBase>> bindings;
+};
+
+template <typename T>
+class PropertyBinding : public BindingBase {
+public:
+    using F_APPLY = std::function<void(const T&)>;
+    PropertyBinding(std::shared_ptr<Observable<T>> src, F_APPLY f) :
+        source(src),
+        applyFn(f),
+        lastVersion(UINT64_MAX) // never applied
+    {}
+    void apply() override {
+        const uint64_t v = source->getVersion();
+        if (v == lastVersion) {
+            return;
+        }
+        lastVersion = v;
+        applyFn(source->get());
+    }
+    std::shared_ptr<Observable<T>> source;
+    F_APPLY applyFn;
+    uint64_t lastVersion;
+};
+
+// Resource accounting.
+// Each Window reports the GDI objects it owns, the heap it holds for rows and
+// cached strings, and its USER handles. See getResourceSnapshot().
+struct ResourceUsage {
+    ResourceUsage() : gdiObjects(0), heapBytes(0), handles(0) {}
+    size_t gdiObjects;
+    size_t heapBytes;
+    size_t handles;
+    ResourceUsage& operator+=(const ResourceUsage& other) {
+        gdiObjects += other.gdiObjects;
+        heapBytes += other.heapBytes;
+        handles += other.handles;
+        return *this;
+    }
+};
+
+// when set, windows report GDI objects that could not be deleted when their
+// window handle is destroyed, and Window objects destroyed while their window
+// handle is still alive
+bool resourceDebug = false;
+
+void setResourceDebug(const bool enable) {
+    resourceDebug = enable;
+}
+
+// heap allocated by a string beyond its inline buffer
+size_t stringHeapBytes(const std::string& str) {
+    static const size_t inlineCapacity = std::string().capacity();
+    return str.capacity() > inlineCapacity ? str.capacity() + 1 : 0;
+}
+
 static HMENU getNextId() {
-    childId++;
-    return (HMENU)childId;
+    // wrap around below the WindowTree range, skipping ids still in use
+    for (int attempts = 0; attempts < STATIC_ID_BASE; ++attempts) {
+        childId++;
+        if (childId >= STATIC_ID_BASE) {
+            childId = 101;
+        }
+        if (windowMap.find((HMENU)childId) == windowMap.end()) {
+            return (HMENU)childId;
+        }
+    }
+    throw std::length_error("xrGUI: no free window ids");
 }
 
 class Window {
 public:
     Window(HWND hPar) :
         hWnd(nullptr),
-        hWndParent(hPar)
+        hWndParent(hPar),
+        font(NULL),
+        subclassed(false)
     {
         id = getNextId();
     }
-    virtual bool onClose() {
-        if (closeCallback) {
-            closeCallback();
+    virtual ~Window() {
+        // queued bindings capture this
+        unbindAll();
+        if (subclassed && IsWindow(hWnd)) {
+            // the window handle outlives this object: stop routing its
+            // messages here and make it drop the font before it is deleted
+            unsubclass();
+            if (font) {
+                SendMessageA(hWnd, WM_SETFONT, 0, FALSE);
+            }
+            if (resourceDebug) {
+                reportLeak("destroyed with a live window handle");
+            }
         }
+        releaseGdiObjects();
+    }
+    virtual bool onClose() {
+        closed.emit();
         DestroyWindow(hWnd);
         return true;
     }
     virtual bool onDestroy() {
-        if (destroyCallback) {
-            destroyCallback();
-        }
+        destroyed.emit();
         return false; //return 0 after processing
     }
     virtual bool onMenuCommand(const int idx) {
@@ -107,50 +651,182 @@ public:
     virtual bool onMeasureItem(UINT message, WPARAM wParam, LPARAM lParam) {
         return false;
     }
+    virtual bool onInitMenuPopup() {
+        return false;
+    }
     virtual LRESULT onColorStatic(UINT message, WPARAM wParam, LPARAM lParam) {
         return 0; // return brush, see WM_CTLCOLORSTATIC
     }
+    // Sees every message sent to a stored window before its own window
+    // procedure. Return true and set result to consume the message.
+    virtual bool onWindowMessage(UINT message, WPARAM wParam, LPARAM lParam, LRESULT& result) {
+        return false;
+    }
+    // WM_NCDESTROY, the last message the window handle receives
+    virtual void onNcDestroy() {
+        unbindAll();
+        const size_t failed = releaseGdiObjects();
+        if (resourceDebug && failed > 0) {
+            reportLeak("could not delete " + std::to_string(failed) + " GDI object(s)");
+        }
+        hWnd = nullptr;
+        subclassed = false;
+    }
+    // false for windows whose hWnd is not a window handle, e.g. menus
+    virtual bool isWindowHandle() const {
+        return true;
+    }
+    // route the window's messages through subclassWndProc; done by store().
+    // Uses the comctl32 subclass chain, so GWLP_USERDATA and subclasses
+    // installed by the application are left alone.
+    void subclass() {
+        if (subclassed || !hWnd || !isWindowHandle()) {
+            return;
+        }
+        subclassed = SetWindowSubclass(hWnd, subclassWndProc, 0, (DWORD_PTR)this) != FALSE;
+    }
+    void unsubclass() {
+        if (!subclassed) {
+            return;
+        }
+        RemoveWindowSubclass(hWnd, subclassWndProc, 0);
+        subclassed = false;
+    }
     virtual void setFont(const std::string& fontName, const long fontSize) {
         HDC hdc = GetDC(hWnd);
         LOGFONTA logFont = { 0 };
         logFont.lfHeight = -MulDiv(fontSize, GetDeviceCaps(hdc, LOGPIXELSY), 72);
         logFont.lfWeight = FW_NORMAL;
         strcpy_s(logFont.lfFaceName, fontName.c_str());
-        //ReleaseDC(hWnd, hdc);
+        ReleaseDC(hWnd, hdc);
         HFONT myFont = CreateFontIndirectA(&logFont);
         SendMessageA(hWnd, WM_SETFONT, WPARAM(myFont), TRUE);
+        // the control no longer references the previous font
+        if (font) {
+            releaseGdiObject(font);
+        }
+        font = myFont;
+        trackGdiObject(font);
     }
     virtual LRESULT onResize(int h, int w) {
-        return resizeCallback(h,w);
+        resized.emit(h, w);
+        return 0; // "If an application processes this message, it should return zero."
+    }
+    // the set*Callback functions replace the slot they previously connected,
+    // or only disconnect it when passed nullptr or an empty function; use the
+    // signals directly to subscribe additional listeners
+    template <typename F>
+    void setResizeCallback(F f) {
+        resizeConn = resized.connectIfSet(f);
+    }
+    template <typename F>
+    void setCloseCallback(F f) {
+        closeConn = closed.connectIfSet(f);
     }
-    void setResizeCallback(F_RESIZE_CALLBACK f) {
-        resizeCallback = f;
+    template <typename F>
+    void setDestroyCallback(F f) {
+        destroyConn = destroyed.connectIfSet(f);
     }
-    void setCloseCallback(F_CALLBACK f) {
-        closeCallback = f;
+    // bind a property of this window to an observable value; f is invoked
+    // on the next flushBindings() and then only when the version advances.
+    // Bindings are detached when the window is destroyed.
+    template <typename T>
+    std::shared_ptr<BindingBase> bind(std::shared_ptr<Observable<T>> src, std::function<void(const T&)> f) {
+        auto b = std::make_shared<PropertyBinding<T>>(src, f);
+        src->attach(b);
+        bindings.push_back(b);
+        queueBinding(b);
+        return b;
     }
-    void setDestroyCallback(F_CALLBACK f) {
-        destroyCallback = f;
+    void unbind(const std::shared_ptr<BindingBase>& b) {
+        for (size_t k = 0; k < bindings.size(); ++k) {
+            if (bindings[k] == b) {
+                b->detach();
+                bindings.erase(bindings.begin() + k);
+                return;
+            }
+        }
+    }
+    void unbindAll() {
+        for (auto& b : bindings) {
+            b->detach();
+        }
+        bindings.clear();
     }
     HWND hWnd;
     HWND hWndParent;
     HMENU id;
-    F_CALLBACK closeCallback;
-    F_CALLBACK destroyCallback;
-    F_RESIZE_CALLBACK resizeCallback;
+    Signal<void()> closed;
+    Signal<void()> destroyed;
+    Signal<void(int, int)> resized;
+    std::vector<std::shared_ptr<BindingBase>> bindings;
+
+    // GDI objects created for this window are tracked so they are counted
+    // in getResourceUsage() and deleted with the window
+    void trackGdiObject(HGDIOBJ obj) {
+        gdiObjects.push_back(obj);
+    }
+    void releaseGdiObject(HGDIOBJ obj) {
+        for (size_t k = 0; k < gdiObjects.size(); ++k) {
+            if (gdiObjects[k] == obj) {
+                gdiObjects[k] = gdiObjects.back();
+                gdiObjects.pop_back();
+                break;
+            }
+        }
+        DeleteObject(obj);
+    }
+    virtual ResourceUsage getResourceUsage() const {
+        ResourceUsage u;
+        u.gdiObjects = gdiObjects.size();
+        u.heapBytes = bindings.capacity() * sizeof(std::shared_ptr<BindingBase>) +
+            gdiObjects.capacity() * sizeof(HGDIOBJ);
+        u.handles = hWnd ? 1 : 0;
+        return u;
+    }
+    HFONT font;
+    // set while subclassWndProc is installed
+    bool subclassed;
+private:
+    // returns the number of objects DeleteObject failed on, e.g. because
+    // they are still selected into a device context
+    size_t releaseGdiObjects() {
+        size_t failed = 0;
+        for (auto obj : gdiObjects) {
+            if (!DeleteObject(obj)) {
+                ++failed;
+            }
+        }
+        gdiObjects.clear();
+        font = NULL;
+        return failed;
+    }
+    void reportLeak(const std::string& what) const {
+        // may run from the destructor, where typeid(*this) is always Window,
+        // so identify by id
+        std::string msg = "xrGUI: window id " + std::to_string((UINT_PTR)id) + " " + what + "\n";
+        OutputDebugStringA(msg.c_str());
+    }
+    std::vector<HGDIOBJ> gdiObjects;
+    ScopedConnection closeConn;
+    ScopedConnection destroyConn;
+    ScopedConnection resizeConn;
 };
 
 class Clickable {
 public:
     virtual void onClick() {
-        if (clickCb != nullptr) {
-            clickCb();
-        }
+        clicked.emit();
     }
-    virtual void setClickCallback(F_CALLBACK f) {
-        clickCb = f;
+    // replaces the slot connected by the previous call; nullptr or an empty
+    // function only disconnects it
+    template <typename F>
+    void setClickCallback(F f) {
+        clickConn = clicked.connectIfSet(f);
     }
-    F_CALLBACK clickCb;
+    Signal<void()> clicked;
+private:
+    ScopedConnection clickConn;
 };
 
 class MainWindow : public Window {
@@ -189,40 +865,282 @@ struct LBString {
     {}
 };
 
+// Run f(begin, end) over [0, n) split across hardware threads. Small ranges
+// run on the calling thread.
+template <typename F>
+void parallelFor(const size_t n, F f, const size_t minPerThread = 16384) {
+    size_t threads = std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 1;
+    }
+    threads = (std::min)(threads, (n + minPerThread - 1) / minPerThread);
+    if (threads <= 1) {
+        f(size_t(0), n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    const size_t chunk = (n + threads - 1) / threads;
+    for (size_t t = 1; t < threads; ++t) {
+        const size_t b = (std::min)(n, t * chunk);
+        const size_t e = (std::min)(n, b + chunk);
+        workers.emplace_back([&f, b, e]() { f(b, e); });
+    }
+    f(size_t(0), (std::min)(n, chunk));
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+// Sort idx with less, sorting chunks on separate threads and then merging
+// pairs of runs in parallel.
+template <typename Less>
+void parallelSort(std::vector<uint32_t>& idx, Less less) {
+    const size_t n = idx.size();
+    const size_t minRun = 65536;
+    size_t runs = std::thread::hardware_concurrency();
+    runs = (std::max<size_t>)(1, (std::min)(runs, n / minRun));
+    if (runs <= 1) {
+        std::sort(idx.begin(), idx.end(), less);
+        return;
+    }
+    std::vector<size_t> bounds(runs + 1);
+    for (size_t k = 0; k <= runs; ++k) {
+        bounds[k] = n * k / runs;
+    }
+    parallelFor(runs, [&](size_t b, size_t e) {
+        for (size_t k = b; k < e; ++k) {
+            std::sort(idx.begin() + bounds[k], idx.begin() + bounds[k + 1], less);
+        }
+    }, 1);
+    while (bounds.size() > 2) {
+        const size_t pairs = (bounds.size() - 1) / 2;
+        parallelFor(pairs, [&](size_t b, size_t e) {
+            for (size_t k = b; k < e; ++k) {
+                std::inplace_merge(idx.begin() + bounds[2 * k],
+                    idx.begin() + bounds[2 * k + 1],
+                    idx.begin() + bounds[2 * k + 2], less);
+            }
+        }, 1);
+        std::vector<size_t> merged;
+        for (size_t k = 0; k < bounds.size(); k += 2) {
+            merged.push_back(bounds[k]);
+        }
+        if (merged.back() != n) {
+            merged.push_back(n);
+        }
+        bounds.swap(merged);
+    }
+}
+
+// Row ordering for a ListBox. Maps displayed rows to indices into the
+// ListBox strings vector without moving the strings themselves.
+class ListBoxSortIndex {
+public:
+    virtual ~ListBoxSortIndex() {}
+    // rebuild order for all rows
+    virtual void sort(const std::vector<LBString>& strings, std::vector<uint32_t>& order) = 0;
+    // merge rows [first, strings.size()) into an already sorted order and
+    // return the displayed row of the last appended string
+    virtual size_t append(const std::vector<LBString>& strings, std::vector<uint32_t>& order, size_t first) = 0;
+    // true if two storage indices belong to the same group
+    virtual bool sameGroup(uint32_t a, uint32_t b) const {
+        return true;
+    }
+    // bytes held for cached keys
+    virtual size_t heapBytes() const {
+        return 0;
+    }
+};
+
+// Keys are extracted once per row and cached, so comparisons do not call
+// the extractor. Ties keep insertion order.
+template <typename Key>
+class KeyedSortIndex : public ListBoxSortIndex {
+public:
+    using F_KEY = std::function<Key(const LBString&)>;
+    KeyedSortIndex(F_KEY k, bool asc) : keyFn(k), ascending(asc) {}
+    void sort(const std::vector<LBString>& strings, std::vector<uint32_t>& order) override {
+        const size_t n = strings.size();
+        keys.clear();
+        keys.resize(n);
+        order.resize(n);
+        parallelFor(n, [&](size_t b, size_t e) {
+            for (size_t k = b; k < e; ++k) {
+                keys[k] = keyFn(strings[k]);
+                order[k] = static_cast<uint32_t>(k);
+            }
+        });
+        parallelSort(order, [this](uint32_t a, uint32_t b) { return less(a, b); });
+    }
+    size_t append(const std::vector<LBString>& strings, std::vector<uint32_t>& order, size_t first) override {
+        const size_t n = strings.size();
+        keys.resize(n);
+        const size_t oldSize = order.size();
+        for (size_t k = first; k < n; ++k) {
+            keys[k] = keyFn(strings[k]);
+            order.push_back(static_cast<uint32_t>(k));
+        }
+        auto cmp = [this](uint32_t a, uint32_t b) { return less(a, b); };
+        if (n - first == 1) {
+            // single row: binary search and shift
+            auto pos = std::upper_bound(order.begin(), order.begin() + oldSize, order.back(), cmp);
+            std::rotate(pos, order.end() - 1, order.end());
+            return pos - order.begin();
+        }
+        std::sort(order.begin() + oldSize, order.end(), cmp);
+        std::inplace_merge(order.begin(), order.begin() + oldSize, order.end(), cmp);
+        return std::find(order.begin(), order.end(), static_cast<uint32_t>(n - 1)) - order.begin();
+    }
+    size_t heapBytes() const override {
+        return keys.capacity() * sizeof(StoredKey);
+    }
+protected:
+    bool less(uint32_t a, uint32_t b) const {
+        if (keys[a] < keys[b]) {
+            return ascending;
+        }
+        if (keys[b] < keys[a]) {
+            return !ascending;
+        }
+        return a < b;
+    }
+    // std::vector<bool> packs bits, which sort() would write from several
+    // threads at once, so bool keys are stored as bytes
+    using StoredKey = typename std::conditional<std::is_same<Key, bool>::value, uint8_t, Key>::type;
+    F_KEY keyFn;
+    bool ascending;
+    std::vector<StoredKey> keys;
+};
+
+// Sorts by group key, then by the row key within each group.
+template <typename GroupKey, typename Key>
+class GroupedSortIndex : public KeyedSortIndex<std::pair<GroupKey, Key>> {
+public:
+    using Base = KeyedSortIndex<std::pair<GroupKey, Key>>;
+    GroupedSortIndex(std::function<GroupKey(const LBString&)> g, std::function<Key(const LBString&)> k, bool asc) :
+        Base([g, k](const LBString& s) { return std::make_pair(g(s), k(s)); }, asc)
+    {}
+    bool sameGroup(uint32_t a, uint32_t b) const override {
+        return !(this->keys[a].first < this->keys[b].first) && !(this->keys[b].first < this->keys[a].first);
+    }
+};
+
 class Menu : public Window {
 public:
-    std::unordered_map<int, F_CALLBACK> itemCBs;
+    using F_POPULATE = std::function<void(Menu&)>;
+    // callbacks indexed by item position; positions taken by submenus or
+    // items without a callback hold an empty function
+    std::vector<F_CALLBACK> itemCBs;
     int nextItemId;
-    Menu() : Window (NULL), nextItemId(0) {
+    Menu() : Window (NULL), nextItemId(0), populated(true) {
         hWnd = (HWND)CreateMenu();
+        // Item command ids are positions and overlap control ids, so
+        // selections must arrive as WM_MENUCOMMAND, routed by menu handle,
+        // rather than as WM_COMMAND, routed by id.
+        MENUINFO menuInfo;
+        memset(&menuInfo, 0, sizeof(menuInfo));
+        menuInfo.cbSize = sizeof(MENUINFO);
+        menuInfo.fMask = MIM_STYLE;
+        menuInfo.dwStyle = MNS_NOTIFYBYPOS;
+        SetMenuInfo((HMENU)hWnd, &menuInfo);
+    }
+    bool isWindowHandle() const override {
+        return false;
     }
+    // returns the item position, which is also its command id
     int addTextItem(const std::string& label) {
         int cid = nextItemId;
         nextItemId++;
         AppendMenuA((HMENU)hWnd, MF_STRING, cid, label.c_str());
+        itemCBs.emplace_back();
         return cid;
     }
     void addSubMenu(std::shared_ptr<Menu> sub, const std::string& label) {
+        nextItemId++;
         AppendMenuA((HMENU)hWnd, MF_POPUP, (UINT_PTR)sub->hWnd, label.c_str());
+        itemCBs.emplace_back();
+    }
+    void reserve(const size_t n) {
+        itemCBs.reserve(n);
+    }
+    // remove all items; submenus are detached but not destroyed
+    void clear() {
+        for (int k = GetMenuItemCount((HMENU)hWnd) - 1; k >= 0; --k) {
+            RemoveMenu((HMENU)hWnd, k, MF_BYPOSITION);
+        }
+        itemCBs.clear();
+        nextItemId = 0;
     }
     void setClickCallback(int id, F_CALLBACK cb) {
+        if (id < 0) {
+            return;
+        }
+        if (static_cast<size_t>(id) >= itemCBs.size()) {
+            itemCBs.resize(id + 1);
+        }
         itemCBs[id] = cb;
     }
-    void onClick(int x) {
-        auto cb = itemCBs[x];
-        cb();
+    // invoked with the item position for items without their own callback,
+    // so large generated menus need no per-item std::function. Connects to
+    // itemClicked, replacing the slot from the previous call; nullptr or an
+    // empty function only disconnects it.
+    template <typename F>
+    void setItemCallback(F f) {
+        itemConn = itemClicked.connectIfSet(f);
     }
-    bool onCommand(UINT message, WPARAM wParam, LPARAM lParam) {
-        onClick((int)LOWORD(wParam));
+    // populate the menu on demand from WM_INITMENUPOPUP. The provider is
+    // called with the menu cleared the first time it opens and again after
+    // each invalidate().
+    void setPopulateCallback(F_POPULATE cb) {
+        populateCallback = cb;
+        populated = false;
+    }
+    void invalidate() {
+        populated = false;
+    }
+    bool onInitMenuPopup() override {
+        if (populated || !populateCallback) {
+            return false;
+        }
+        clear();
+        populateCallback(*this);
+        populated = true;
         return true;
     }
-    bool onMenuCommand(const int idx) override {
-        if (itemCBs.find(idx) == itemCBs.end()) {
+    bool onClick(int x) {
+        if (x < 0 || x >= nextItemId) {
             return false;
         }
-        itemCBs[idx]();
+        if (static_cast<size_t>(x) < itemCBs.size() && itemCBs[x]) {
+            itemCBs[x]();
+            return true;
+        }
+        if (!itemClicked.empty()) {
+            itemClicked.emit(x);
+            return true;
+        }
+        return false;
+    }
+    bool onCommand(UINT message, WPARAM wParam, LPARAM lParam) {
+        onClick((int)LOWORD(wParam));
         return true;
     }
+    bool onMenuCommand(const int idx) override {
+        return onClick(idx);
+    }
+    ResourceUsage getResourceUsage() const override {
+        ResourceUsage u = Window::getResourceUsage();
+        u.heapBytes += itemCBs.capacity() * sizeof(F_CALLBACK);
+        return u;
+    }
+    // emitted with the item position for selected items without their own
+    // callback
+    Signal<void(int)> itemClicked;
+private:
+    F_POPULATE populateCallback;
+    ScopedConnection itemConn;
+    bool populated;
 };
 
 class OpenGLContext : public Window {
@@ -264,6 +1182,9 @@ public:
     void setText(const std::string& str) {
         SendMessageA(hWnd, WM_SETTEXT, NULL, (LPARAM)str.c_str());
     }
+    std::shared_ptr<BindingBase> bindText(std::shared_ptr<Observable<std::string>> src) {
+        return bind<std::string>(src, [this](const std::string& s) { setText(s); });
+    }
     bool onCommand(UINT message, WPARAM wParam, LPARAM lParam) override {
         onClick();
         return true;
@@ -278,7 +1199,8 @@ public:
 class ComboBox : public Window, public Clickable {
 public:
     std::vector<std::string> strings;
-    ComboBox(HWND hPar, HINSTANCE hInstance) : Window(hPar) {
+    size_t stringBytes;
+    ComboBox(HWND hPar, HINSTANCE hInstance) : Window(hPar), stringBytes(0) {
         hWnd = CreateWindowEx(
             WS_EX_CLIENTEDGE,
             "ComboBox",
@@ -307,6 +1229,18 @@ public:
             0,
             (LPARAM)str.c_str());
         strings.push_back(str);
+        stringBytes += stringHeapBytes(strings.back());
+    }
+    void clear() {
+        SendMessageA(hWnd, CB_RESETCONTENT, 0, 0);
+        strings.clear();
+        strings.shrink_to_fit();
+        stringBytes = 0;
+    }
+    ResourceUsage getResourceUsage() const override {
+        ResourceUsage u = Window::getResourceUsage();
+        u.heapBytes += strings.capacity() * sizeof(std::string) + stringBytes;
+        return u;
     }
     bool onDraw(UINT message, WPARAM wParam, LPARAM lParam) override {
         COLORREF clrBackground;
@@ -380,7 +1314,7 @@ public:
 
 class ListBox : public Window {
 public:
-    ListBox(HWND hPar, HINSTANCE hInstance) : Window(hPar) {
+    ListBox(HWND hPar, HINSTANCE hInstance) : Window(hPar), stringBytes(0) {
         hWnd = CreateWindowEx(
             WS_EX_CLIENTEDGE,
             "ListBox",
@@ -405,19 +1339,94 @@ public:
             0,
             (LPARAM)str.str.c_str());
         strings.push_back(str);
-        SendMessageA(hWnd, LB_SETTOPINDEX, strings.size() - 1, 0);
+        stringBytes += stringHeapBytes(strings.back().str);
+        size_t row = strings.size() - 1;
+        if (sortIndex) {
+            row = sortIndex->append(strings, order, strings.size() - 1);
+            InvalidateRect(hWnd, NULL, TRUE);
+        }
+        SendMessageA(hWnd, LB_SETTOPINDEX, row, 0);
 
        // UpdateWindow(hWnd);
 
     }
+    // append many rows at once; the row count is set with a single message
+    // and, when sorted, the new rows are merged into the existing order
+    void addStrings(const std::vector<LBString>& strs) {
+        if (strs.empty()) {
+            return;
+        }
+        const size_t first = strings.size();
+        strings.insert(strings.end(), strs.begin(), strs.end());
+        for (size_t k = first; k < strings.size(); ++k) {
+            stringBytes += stringHeapBytes(strings[k].str);
+        }
+        SendMessageA(hWnd, LB_SETCOUNT, strings.size(), 0);
+        if (sortIndex) {
+            sortIndex->append(strings, order, first);
+        }
+        InvalidateRect(hWnd, NULL, TRUE);
+    }
+    // Display rows ordered by key(row). Keys are extracted and sorted across
+    // all cores; strings is left untouched. Later appends are merged into
+    // the sorted order until clearSort() is called.
+    template <typename KeyFn>
+    void sortBy(KeyFn key, const bool ascending = true) {
+        using Key = typename std::decay<decltype(key(std::declval<const LBString&>()))>::type;
+        setSortIndex(std::make_shared<KeyedSortIndex<Key>>(key, ascending));
+    }
+    // Display rows ordered by group(row) and then key(row), with a separator
+    // line drawn above the first row of each group.
+    template <typename GroupFn, typename KeyFn>
+    void groupBy(GroupFn group, KeyFn key, const bool ascending = true) {
+        using GroupKey = typename std::decay<decltype(group(std::declval<const LBString&>()))>::type;
+        using Key = typename std::decay<decltype(key(std::declval<const LBString&>()))>::type;
+        setSortIndex(std::make_shared<GroupedSortIndex<GroupKey, Key>>(group, key, ascending));
+    }
+    void setSortIndex(std::shared_ptr<ListBoxSortIndex> idx) {
+        sortIndex = idx;
+        sortIndex->sort(strings, order);
+        InvalidateRect(hWnd, NULL, TRUE);
+    }
+    // return to insertion order
+    void clearSort() {
+        sortIndex.reset();
+        order.clear();
+        order.shrink_to_fit();
+        InvalidateRect(hWnd, NULL, TRUE);
+    }
+    void clear() {
+        SendMessageA(hWnd, LB_RESETCONTENT, 0, 0);
+        strings.clear();
+        strings.shrink_to_fit();
+        stringBytes = 0;
+        if (sortIndex) {
+            sortIndex->sort(strings, order);
+        }
+    }
+    ResourceUsage getResourceUsage() const override {
+        ResourceUsage u = Window::getResourceUsage();
+        u.heapBytes += strings.capacity() * sizeof(LBString) + stringBytes +
+            order.capacity() * sizeof(uint32_t);
+        if (sortIndex) {
+            u.heapBytes += sortIndex->heapBytes();
+        }
+        return u;
+    }
+    // index into strings of the displayed row
+    size_t rowToIndex(const size_t row) const {
+        return sortIndex ? order[row] : row;
+    }
     bool onDraw(UINT message, WPARAM wParam, LPARAM lParam) override {
         if (strings.empty()){return true;}
         PDRAWITEMSTRUCT pdis = (PDRAWITEMSTRUCT)lParam;
         if (pdis->itemID==-1) { return true; }
+        if (pdis->itemID >= strings.size()) { return true; }
 
         TEXTMETRICA tm;
         size_t cch;
-        auto& itemStr = strings[pdis->itemID];
+        const size_t strIdx = rowToIndex(pdis->itemID);
+        auto& itemStr = strings[strIdx];
         /*
         // Get the item string from the list box.
         SendMessageA(hWnd, LB_GETTEXT,
@@ -439,9 +1448,19 @@ public:
         SetTextColor(pdis->hDC, itemStr.rgb_fg.toColorRef());
         TextOutA(pdis->hDC, 6, yPos, itemStr.str.c_str(), cch);
         DeleteObject(brush);
+        if (sortIndex && pdis->itemID > 0 &&
+            !sortIndex->sameGroup(order[pdis->itemID - 1], static_cast<uint32_t>(strIdx))) {
+            // first row of a new group
+            MoveToEx(pdis->hDC, pdis->rcItem.left, pdis->rcItem.top, NULL);
+            LineTo(pdis->hDC, pdis->rcItem.right, pdis->rcItem.top);
+        }
         return true;
     }
     std::vector<LBString> strings;
+    size_t stringBytes;
+    // displayed row -> index into strings, only used while sorted
+    std::vector<uint32_t> order;
+    std::shared_ptr<ListBoxSortIndex> sortIndex;
 };
 
 class Static : public Window {
@@ -464,14 +1483,17 @@ public:
     }
     LRESULT onColorStatic(UINT message, WPARAM wParam, LPARAM lParam) override {
         if (hBrushLabel) {
-            DeleteObject(hBrushLabel);
+            releaseGdiObject(hBrushLabel);
             hBrushLabel = NULL;
         }
         HDC hdc = reinterpret_cast<HDC>(wParam);
         //SetTextColor(hdc, RGB(0,0,0));
         auto oldColor = SetBkColor(hdc, backgroundColor.toColorRef());
         ::GetSysColorBrush(COLOR_WINDOW);
-        if (!hBrushLabel) hBrushLabel = CreateSolidBrush(backgroundColor.toColorRef());
+        if (!hBrushLabel) {
+            hBrushLabel = CreateSolidBrush(backgroundColor.toColorRef());
+            trackGdiObject(hBrushLabel);
+        }
         return (LRESULT) hBrushLabel;
     }
     void setText(const std::string& str) {
@@ -481,6 +1503,12 @@ public:
         backgroundColor = c;
         InvalidateRect(hWnd, NULL, TRUE);
     }
+    std::shared_ptr<BindingBase> bindText(std::shared_ptr<Observable<std::string>> src) {
+        return bind<std::string>(src, [this](const std::string& s) { setText(s); });
+    }
+    std::shared_ptr<BindingBase> bindBackgroundColor(std::shared_ptr<Observable<WinColor>> src) {
+        return bind<WinColor>(src, [this](const WinColor& c) { setBackgroundColor(c); });
+    }
     HBRUSH hBrushLabel;
     WinColor backgroundColor;
 };
@@ -508,6 +1536,9 @@ public:
     void setText(const std::string& str) {
         SetWindowTextA(hWnd, (LPCSTR)str.c_str());
     }
+    std::shared_ptr<BindingBase> bindText(std::shared_ptr<Observable<std::string>> src) {
+        return bind<std::string>(src, [this](const std::string& s) { setText(s); });
+    }
     std::string getText() {
         char c[MAX_PATH] = {0};
         GetWindowTextA(hWnd, c, MAX_PATH);
@@ -529,20 +1560,251 @@ std::shared_ptr<T> makeWindow(Args... args) {
     return newWindow;
 }
 
-void store(std::shared_ptr<Window> w) {
-    windowMap[w->id] = w;
+// Declarative window trees.
+// A control is described by a descriptor type deriving from ControlDesc and
+// overriding any of its static members:
+//
+//   struct Title : ControlDesc<Static, 1> {
+//       static constexpr const char* text = "Title";
+//       static constexpr const char* font = "Arial";
+//       static constexpr long fontSize = 11;
+//       static constexpr XYWH pos = { 10, 10, 200, 20 };
+//   };
+//   using Screen = WindowTree<Title, Other>;
+//   auto screen = Screen::create(mainWindow, hInstance);
+//   screen->get<Title>().setText("...");
+//
+// All controls are children of the parent passed to create() and are
+// constructed in a single contiguous allocation. Descriptor ids must be
+// unique within the tree and not exceed STATIC_ID_MAX; this is checked at
+// compile time. Each tree reserves max id + 1 command ids until it is
+// destroyed; create() throws std::length_error if no range is free.
+template <typename T, int Id>
+struct ControlDesc {
+    using type = T;
+    static constexpr int id = Id;
+    static constexpr const char* text = nullptr;
+    static constexpr const char* font = nullptr;
+    static constexpr long fontSize = 0;
+    static constexpr XYWH pos = { 0, 0, 0, 0 };
+};
+
+template <typename T>
+typename std::enable_if<std::is_constructible<T, HWND, HINSTANCE>::value, T*>::type
+constructControl(void* p, HWND hPar, HINSTANCE hInstance) {
+    return new (p) T(hPar, hInstance);
 }
 
-std::shared_ptr<Window> getWindowByHandle(HWND hTest) {
-    for (auto& w : windowMap) {
-        if (w.second->hWnd == hTest) {
-            return w.second;
+template <typename T>
+typename std::enable_if<!std::is_constructible<T, HWND, HINSTANCE>::value, T*>::type
+constructControl(void* p, HWND hPar, HINSTANCE hInstance) {
+    static_assert(std::is_constructible<T, HWND>::value,
+        "WindowTree controls must be constructible from (HWND) or (HWND, HINSTANCE)");
+    return new (p) T(hPar);
+}
+
+constexpr size_t alignUp(const size_t at, const size_t alignment) {
+    return (at + alignment - 1) / alignment * alignment;
+}
+
+// byte offset of control idx in a block holding Ts..., or the block size
+// for idx == sizeof...(Ts)
+template <typename... Ts>
+constexpr size_t controlOffset(const size_t idx) {
+    const size_t sizes[] = { sizeof(Ts)... };
+    const size_t aligns[] = { alignof(Ts)... };
+    size_t at = 0;
+    for (size_t k = 0; k < sizeof...(Ts); ++k) {
+        at = alignUp(at, aligns[k]);
+        if (k == idx) {
+            return at;
         }
+        at += sizes[k];
     }
-    return nullptr;
+    return at;
+}
+
+template <typename... Descs>
+constexpr bool validTreeIds() {
+    const int ids[] = { Descs::id... };
+    for (size_t k = 0; k < sizeof...(Descs); ++k) {
+        if (ids[k] < 0 || ids[k] > STATIC_ID_MAX) {
+            return false;
+        }
+        for (size_t j = k + 1; j < sizeof...(Descs); ++j) {
+            if (ids[k] == ids[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename... Descs>
+constexpr int maxTreeId() {
+    const int ids[] = { Descs::id... };
+    int m = 0;
+    for (size_t k = 0; k < sizeof...(Descs); ++k) {
+        m = ids[k] > m ? ids[k] : m;
+    }
+    return m;
+}
+
+template <typename D, typename... Descs>
+constexpr size_t treeIndexOf() {
+    const bool matches[] = { std::is_same<D, Descs>::value... };
+    for (size_t k = 0; k < sizeof...(Descs); ++k) {
+        if (matches[k]) {
+            return k;
+        }
+    }
+    return sizeof...(Descs);
+}
+
+template <typename... Descs>
+class WindowTree : public std::enable_shared_from_this<WindowTree<Descs...>> {
+public:
+    static constexpr size_t count = sizeof...(Descs);
+    static_assert(count > 0, "WindowTree needs at least one control");
+    static_assert(validTreeIds<Descs...>(), "WindowTree ids must be unique and within [0, STATIC_ID_MAX]");
+    static constexpr int span = maxTreeId<Descs...>() + 1;
+
+    static std::shared_ptr<WindowTree> create(std::shared_ptr<Window> parent, HINSTANCE hInstance) {
+        auto tree = std::shared_ptr<WindowTree>(new WindowTree(allocateStaticSlots(span)));
+        tree->build(parent->hWnd, hInstance, std::index_sequence_for<Descs...>());
+        tree->registerControls();
+        return tree;
+    }
+    ~WindowTree() {
+        void (*const destroyers[])(void*) = { &destroyAt<typename Descs::type>... };
+        const size_t offsets[] = { controlOffset<typename Descs::type...>(treeIndexOf<Descs, Descs...>())... };
+        for (size_t k = constructed; k > 0; --k) {
+            destroyers[k - 1](storage + offsets[k - 1]);
+        }
+        // the id tables hold the tree while any control is registered, so
+        // its ids are unused by now
+        releaseStaticSlots(slotBase, span);
+    }
+    WindowTree(const WindowTree&) = delete;
+    WindowTree& operator=(const WindowTree&) = delete;
+
+    template <typename D>
+    static constexpr size_t indexOf() {
+        return treeIndexOf<D, Descs...>();
+    }
+    template <typename D>
+    HMENU commandId() const {
+        return (HMENU)(UINT_PTR)(STATIC_ID_BASE + slotBase + D::id);
+    }
+    template <typename D>
+    typename D::type& get() {
+        static_assert(treeIndexOf<D, Descs...>() < count, "descriptor is not part of this WindowTree");
+        return *static_cast<typename D::type*>(windows[treeIndexOf<D, Descs...>()]);
+    }
+    // shared_ptr to a control which keeps the whole tree alive
+    template <typename D>
+    std::shared_ptr<typename D::type> share() {
+        return std::shared_ptr<typename D::type>(this->shared_from_this(), &get<D>());
+    }
+    Window& at(const size_t idx) {
+        return *windows[idx];
+    }
+
+private:
+    template <typename T>
+    static void destroyAt(void* p) {
+        static_cast<T*>(p)->~T();
+    }
+
+    explicit WindowTree(const int base) : windows(), constructed(0), slotBase(base) {}
+
+    template <size_t... I>
+    void build(HWND hPar, HINSTANCE hInstance, std::index_sequence<I...>) {
+        int expand[] = { (construct<I, Descs>(hPar, hInstance), 0)... };
+        (void)expand;
+    }
+    template <size_t I, typename D>
+    void construct(HWND hPar, HINSTANCE hInstance) {
+        using T = typename D::type;
+        static_assert(std::is_base_of<Window, T>::value, "WindowTree controls must derive from Window");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned control type");
+        void* p = storage + controlOffset<typename Descs::type...>(I);
+        T* w = constructControl<T>(p, hPar, hInstance);
+        windows[I] = w;
+        constructed = I + 1;
+        w->id = commandId<D>();
+        SetWindowLongPtr(w->hWnd, GWLP_ID, (LONG_PTR)w->id);
+        if (D::text) {
+            SetWindowTextA(w->hWnd, D::text);
+        }
+        if (D::font) {
+            w->setFont(D::font, D::fontSize);
+        }
+        // copy the members, D::pos itself is not defined out of class
+        const XYWH pos = { D::pos.x, D::pos.y, D::pos.w, D::pos.h };
+        if (pos.w > 0 || pos.h > 0) {
+            w->setPosition(pos);
+        }
+    }
+    void registerControls() {
+        auto self = this->shared_from_this();
+        for (size_t k = 0; k < count; ++k) {
+            std::shared_ptr<Window> w(self, windows[k]);
+            const size_t slot = (UINT_PTR)w->id - STATIC_ID_BASE;
+            if (staticIdTable.size() <= slot) {
+                staticIdTable.resize(slot + 1);
+            }
+            if (staticIdTable[slot] || windowMap.count(w->id)) {
+                throw std::logic_error("xrGUI: WindowTree command id already registered");
+            }
+            staticIdTable[slot] = w;
+            // handle based lookups (e.g. WM_CTLCOLORSTATIC) still use windowMap
+            windowMap[w->id] = w;
+            w->subclass();
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[controlOffset<typename Descs::type...>(sizeof...(Descs))];
+    std::array<Window*, count> windows;
+    size_t constructed;
+    int slotBase;
+};
+
+void store(std::shared_ptr<Window> w) {
+    windowMap[w->id] = w;
+    w->subclass();
+}
+
+// drop w from the lookup tables once its window handle is destroyed
+void unregisterWindow(Window* w) {
+    auto it = windowMap.find(w->id);
+    if (it != windowMap.end() && it->second.get() == w) {
+        windowMap.erase(it);
+    }
+    const UINT_PTR staticIdx = (UINT_PTR)w->id - STATIC_ID_BASE;
+    if ((UINT_PTR)w->id >= STATIC_ID_BASE && staticIdx < staticIdTable.size() &&
+        staticIdTable[staticIdx].get() == w) {
+        staticIdTable[staticIdx] = nullptr;
+    }
+}
+
+std::shared_ptr<Window> getWindowByHandle(HWND hTest) {
+    for (auto& w : windowMap) {
+        if (w.second->hWnd == hTest) {
+            return w.second;
+        }
+    }
+    return nullptr;
 }
 
 std::shared_ptr<Window> getWindowById(HMENU h) {
+    const UINT_PTR staticIdx = (UINT_PTR)h - STATIC_ID_BASE;
+    if ((UINT_PTR)h >= STATIC_ID_BASE && staticIdx < staticIdTable.size()) {
+        // controls declared in a WindowTree, resolved by index
+        if (staticIdTable[staticIdx]) {
+            return staticIdTable[staticIdx];
+        }
+    }
     if (windowMap.find(h) == windowMap.end()) {
         return nullptr;
     }
@@ -565,6 +1827,10 @@ LRESULT handleWinMessage(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     else if (WM_DESTROY == message) {
         w = getWindowByHandle(hWnd);
     }
+    else if (WM_INITMENUPOPUP == message) {
+        // wParam is the HMENU of the popup being opened
+        w = getWindowByHandle((HWND)wParam);
+    }
     else {
         // lParam is an ID, aka HMENU
         w = getWindowById((HMENU)LOWORD(wParam));
@@ -581,6 +1847,9 @@ LRESULT handleWinMessage(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         case WM_MENUCOMMAND:
             handled = w->onMenuCommand(wParam);
             break;
+        case WM_INITMENUPOPUP:
+            handled = w->onInitMenuPopup();
+            break;
         case WM_COMMAND:
             handled = w->onCommand(message, wParam, lParam);
             break;
@@ -612,6 +1881,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_CLOSE:
     case WM_DRAWITEM:
     case WM_MENUCOMMAND:
+    case WM_INITMENUPOPUP:
     case WM_COMMAND:
     case WM_MEASUREITEM:
         return handleWinMessage(hWnd, message, wParam, lParam);
@@ -641,4 +1911,1413 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     return 0;
 }
 
+LRESULT CALLBACK subclassWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam,
+    UINT_PTR subclassId, DWORD_PTR refData)
+{
+    Window* w = (Window*)refData;
+    if (WM_NCDESTROY == message) {
+        // the lookup tables may hold the last reference
+        std::shared_ptr<Window> keep = getWindowById(w->id);
+        RemoveWindowSubclass(hWnd, subclassWndProc, subclassId);
+        const LRESULT result = DefSubclassProc(hWnd, message, wParam, lParam);
+        w->onNcDestroy();
+        unregisterWindow(w);
+        return result;
+    }
+    LRESULT result = 0;
+    if (w->onWindowMessage(message, wParam, lParam, result)) {
+        return result;
+    }
+    return DefSubclassProc(hWnd, message, wParam, lParam);
+}
+
+// Message loop.
+// run() replaces the hand written GetMessage/DispatchMessage loop. Besides
+// dispatching messages and flushing bindings it waits on registered handles,
+// fires timers and runs idle tasks, all on the UI thread. Idle tasks run in
+// short time slices and yield as soon as input or a message is pending.
+// An idle task returns true while it has more work to do.
+using F_IDLE_TASK = std::function<bool()>;
+
+struct LoopTimer {
+    std::chrono::steady_clock::time_point due;
+    std::chrono::milliseconds interval;
+    bool repeat;
+    F_CALLBACK cb;
+};
+
+struct MessageLoopState {
+    MessageLoopState() : nextTimerId(1), idleSlice(8) {}
+    std::vector<HANDLE> handles;
+    std::vector<F_CALLBACK> handleCBs;
+    std::deque<F_IDLE_TASK> idleTasks;
+    std::unordered_map<int, LoopTimer> timers;
+    // min-heap of (due, timer id); entries for cancelled or rescheduled
+    // timers are discarded when popped
+    using TimerSlot = std::pair<std::chrono::steady_clock::time_point, int>;
+    std::priority_queue<TimerSlot, std::vector<TimerSlot>, std::greater<TimerSlot>> timerQueue;
+    int nextTimerId;
+    std::chrono::milliseconds idleSlice;
+};
+
+MessageLoopState messageLoop;
+
+// cb runs on the UI thread each time h is signaled. At most
+// MAXIMUM_WAIT_OBJECTS - 1 handles may be registered.
+bool addWaitHandle(HANDLE h, F_CALLBACK cb) {
+    if (messageLoop.handles.size() >= MAXIMUM_WAIT_OBJECTS - 1) {
+        return false;
+    }
+    messageLoop.handles.push_back(h);
+    messageLoop.handleCBs.push_back(cb);
+    return true;
+}
+
+void removeWaitHandle(HANDLE h) {
+    for (size_t k = 0; k < messageLoop.handles.size(); ++k) {
+        if (messageLoop.handles[k] == h) {
+            messageLoop.handles.erase(messageLoop.handles.begin() + k);
+            messageLoop.handleCBs.erase(messageLoop.handleCBs.begin() + k);
+            return;
+        }
+    }
+}
+
+void postIdleTask(F_IDLE_TASK task) {
+    messageLoop.idleTasks.push_back(task);
+}
+
+// maximum time spent in idle tasks before checking for messages again
+void setIdleSlice(const unsigned int ms) {
+    messageLoop.idleSlice = std::chrono::milliseconds(ms);
+}
+
+// returns an id for cancelTimer. Intervals below 1 ms are rounded up to 1 ms.
+int addTimer(const unsigned int ms, F_CALLBACK cb, const bool repeat = true) {
+    const int timerId = messageLoop.nextTimerId++;
+    LoopTimer t;
+    t.interval = std::chrono::milliseconds(ms > 0 ? ms : 1);
+    t.due = std::chrono::steady_clock::now() + t.interval;
+    t.repeat = repeat;
+    t.cb = cb;
+    messageLoop.timerQueue.push(std::make_pair(t.due, timerId));
+    messageLoop.timers[timerId] = t;
+    return timerId;
+}
+
+void cancelTimer(const int timerId) {
+    messageLoop.timers.erase(timerId);
+}
+
+// fire due timers and return the wait timeout until the next one
+DWORD runTimers() {
+    auto& q = messageLoop.timerQueue;
+    // only timers due on entry fire: a repeating timer is rescheduled at
+    // least 1 ms past now, so it cannot fire twice in one pass and starve the
+    // message queue
+    const auto now = std::chrono::steady_clock::now();
+    while (!q.empty()) {
+        auto top = q.top();
+        auto it = messageLoop.timers.find(top.second);
+        if (it == messageLoop.timers.end() || it->second.due != top.first) {
+            q.pop(); // stale entry
+            continue;
+        }
+        if (top.first > now) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                top.first - std::chrono::steady_clock::now()).count();
+            return wait < 0 ? 0 : static_cast<DWORD>(wait + 1);
+        }
+        q.pop();
+        F_CALLBACK cb = it->second.cb;
+        if (it->second.repeat) {
+            it->second.due = now + it->second.interval;
+            q.push(std::make_pair(it->second.due, top.second));
+        }
+        else {
+            messageLoop.timers.erase(it);
+        }
+        cb();
+    }
+    return INFINITE;
+}
+
+// run idle tasks round-robin until the slice expires or a message arrives
+void runIdleTasks() {
+    const auto end = std::chrono::steady_clock::now() + messageLoop.idleSlice;
+    while (!messageLoop.idleTasks.empty()) {
+        F_IDLE_TASK task = messageLoop.idleTasks.front();
+        messageLoop.idleTasks.pop_front();
+        if (task()) {
+            messageLoop.idleTasks.push_back(task);
+        }
+        if (HIWORD(GetQueueStatus(QS_ALLINPUT)) != 0 || std::chrono::steady_clock::now() >= end) {
+            return;
+        }
+    }
+}
+
+// Called when the wait failed: drop registered handles which are no longer
+// valid, e.g. closed without removeWaitHandle, and report them. Returns the
+// number dropped.
+size_t dropInvalidWaitHandles() {
+    size_t dropped = 0;
+    for (size_t k = messageLoop.handles.size(); k > 0; --k) {
+        HANDLE h = messageLoop.handles[k - 1];
+        if (WaitForSingleObject(h, 0) != WAIT_FAILED) {
+            continue;
+        }
+        std::string msg = "xrGUI: dropping invalid wait handle " + std::to_string((UINT_PTR)h) +
+            " (error " + std::to_string(GetLastError()) + ")\n";
+        OutputDebugStringA(msg.c_str());
+        messageLoop.handles.erase(messageLoop.handles.begin() + (k - 1));
+        messageLoop.handleCBs.erase(messageLoop.handleCBs.begin() + (k - 1));
+        dropped++;
+    }
+    return dropped;
+}
+
+// returns the exit code passed to PostQuitMessage
+int run() {
+    MSG msg;
+    for (;;) {
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                return (int)msg.wParam;
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+        flushBindings();
+        DWORD timeout = runTimers();
+        if (!messageLoop.idleTasks.empty()) {
+            runIdleTasks();
+            flushBindings();
+            if (!messageLoop.idleTasks.empty()) {
+                timeout = 0; // just poll, there is more idle work
+            }
+        }
+        const DWORD count = static_cast<DWORD>(messageLoop.handles.size());
+        const DWORD r = MsgWaitForMultipleObjectsEx(count,
+            count ? messageLoop.handles.data() : nullptr,
+            timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE | MWMO_ALERTABLE);
+        DWORD signaled = count;
+        if (r == WAIT_FAILED) {
+            const DWORD err = GetLastError();
+            if (dropInvalidWaitHandles() == 0) {
+                // not caused by a handle; wait for messages alone rather
+                // than spin
+                std::string msg = "xrGUI: MsgWaitForMultipleObjectsEx failed (error " +
+                    std::to_string(err) + ")\n";
+                OutputDebugStringA(msg.c_str());
+                MsgWaitForMultipleObjectsEx(0, nullptr, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE | MWMO_ALERTABLE);
+            }
+        }
+        else if (r >= WAIT_OBJECT_0 && r < WAIT_OBJECT_0 + count) {
+            signaled = r - WAIT_OBJECT_0;
+        }
+        else if (r >= WAIT_ABANDONED_0 && r < WAIT_ABANDONED_0 + count) {
+            signaled = r - WAIT_ABANDONED_0;
+        }
+        if (signaled < count) {
+            // copy, the callback may remove its own handle
+            F_CALLBACK cb = messageLoop.handleCBs[signaled];
+            cb();
+        }
+    }
+}
+
+// Images.
+// Frames are decoded and downscaled on worker threads into DIB sections,
+// which are kept in a memory-budgeted LRU cache shared by all image
+// controls. The UI thread only looks images up in the cache and queues
+// decodes for misses. Workers hand finished images over by posting a message
+// to a message-only window, so they also arrive while a modal loop (scroll
+// bar drag, menu, move/size) or an application's own message loop runs.
+enum class RawFormat {
+    Gray8,
+    BGR24,
+    BGRA32
+};
+
+struct ImageSource {
+    ImageSource() : rawWidth(0), rawHeight(0), rawFormat(RawFormat::BGRA32) {}
+    ImageSource(const std::string& p) : path(p), rawWidth(0), rawHeight(0), rawFormat(RawFormat::BGRA32) {}
+    ImageSource(const char* p) : path(p), rawWidth(0), rawHeight(0), rawFormat(RawFormat::BGRA32) {}
+    std::string cacheKey() const {
+        return key.empty() ? path : key;
+    }
+    // .bmp, .ppm/.pgm or raw file, read when data is null
+    std::string path;
+    // identifies in-memory frames in the cache; defaults to path
+    std::string key;
+    // encoded or raw bytes in memory
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    // when rawWidth > 0 the bytes are headerless top-down pixels
+    int rawWidth;
+    int rawHeight;
+    RawFormat rawFormat;
+};
+
+// top-down 32 bit BGRA pixels
+struct Bitmap32 {
+    Bitmap32() : w(0), h(0) {}
+    int w;
+    int h;
+    std::vector<uint32_t> px;
+};
+
+static uint32_t readLE32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint16_t readLE16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t packBGRA(uint8_t b, uint8_t g, uint8_t r) {
+    return b | (g << 8) | (r << 16) | 0xFF000000u;
+}
+
+bool readFileBytes(const std::string& path, std::vector<uint8_t>& out) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (!f) {
+        return false;
+    }
+    const std::streamsize n = f.tellg();
+    if (n <= 0) {
+        return false;
+    }
+    out.resize(static_cast<size_t>(n));
+    f.seekg(0);
+    return static_cast<bool>(f.read(reinterpret_cast<char*>(out.data()), n));
+}
+
+bool decodeRaw(const uint8_t* d, const size_t n, const int w, const int h, const RawFormat fmt, Bitmap32& out) {
+    const size_t bpp = fmt == RawFormat::Gray8 ? 1 : (fmt == RawFormat::BGR24 ? 3 : 4);
+    if (w <= 0 || h <= 0 || n < static_cast<size_t>(w) * h * bpp) {
+        return false;
+    }
+    out.w = w;
+    out.h = h;
+    out.px.resize(static_cast<size_t>(w) * h);
+    const size_t count = out.px.size();
+    if (fmt == RawFormat::BGRA32) {
+        memcpy(out.px.data(), d, count * 4);
+    }
+    else if (fmt == RawFormat::BGR24) {
+        for (size_t k = 0; k < count; ++k) {
+            out.px[k] = packBGRA(d[3 * k], d[3 * k + 1], d[3 * k + 2]);
+        }
+    }
+    else {
+        for (size_t k = 0; k < count; ++k) {
+            out.px[k] = packBGRA(d[k], d[k], d[k]);
+        }
+    }
+    return true;
+}
+
+// uncompressed 8 (palette), 24 and 32 bit BMP
+bool decodeBmp(const uint8_t* d, const size_t n, Bitmap32& out) {
+    if (n < 54 || d[0] != 'B' || d[1] != 'M') {
+        return false;
+    }
+    const uint32_t pixOffset = readLE32(d + 10);
+    const uint32_t hdrSize = readLE32(d + 14);
+    const int32_t w = static_cast<int32_t>(readLE32(d + 18));
+    const int32_t hSigned = static_cast<int32_t>(readLE32(d + 22));
+    const uint16_t bits = readLE16(d + 28);
+    const uint32_t compression = readLE32(d + 30);
+    const bool topDown = hSigned < 0;
+    const int32_t h = topDown ? -hSigned : hSigned;
+    if (w <= 0 || h <= 0 || (compression != BI_RGB && !(compression == 3 && bits == 32))) {
+        return false;
+    }
+    if (bits != 8 && bits != 24 && bits != 32) {
+        return false;
+    }
+    const size_t stride = ((static_cast<size_t>(w) * bits + 31) / 32) * 4;
+    if (pixOffset > n || n - pixOffset < stride * h) {
+        return false;
+    }
+    uint32_t palette[256] = { 0 };
+    if (bits == 8) {
+        const uint8_t* pal = d + 14 + hdrSize;
+        const uint32_t used = readLE32(d + 46);
+        const uint32_t entries = used ? (std::min<uint32_t>)(used, 256) : 256;
+        if (pal + entries * 4 > d + pixOffset) {
+            return false;
+        }
+        for (uint32_t k = 0; k < entries; ++k) {
+            palette[k] = packBGRA(pal[4 * k], pal[4 * k + 1], pal[4 * k + 2]);
+        }
+    }
+    out.w = w;
+    out.h = h;
+    out.px.resize(static_cast<size_t>(w) * h);
+    for (int32_t y = 0; y < h; ++y) {
+        const uint8_t* row = d + pixOffset + stride * (topDown ? y : h - 1 - y);
+        uint32_t* dst = out.px.data() + static_cast<size_t>(y) * w;
+        if (bits == 32) {
+            for (int32_t x = 0; x < w; ++x) {
+                dst[x] = readLE32(row + 4 * x) | 0xFF000000u;
+            }
+        }
+        else if (bits == 24) {
+            for (int32_t x = 0; x < w; ++x) {
+                dst[x] = packBGRA(row[3 * x], row[3 * x + 1], row[3 * x + 2]);
+            }
+        }
+        else {
+            for (int32_t x = 0; x < w; ++x) {
+                dst[x] = palette[row[x]];
+            }
+        }
+    }
+    return true;
+}
+
+// binary PPM (P6) and PGM (P5) with maxval up to 255
+bool decodePpm(const uint8_t* d, const size_t n, Bitmap32& out) {
+    if (n < 3 || d[0] != 'P' || (d[1] != '6' && d[1] != '5')) {
+        return false;
+    }
+    const bool gray = d[1] == '5';
+    size_t pos = 2;
+    long fields[3] = { 0, 0, 0 };
+    for (int f = 0; f < 3; ++f) {
+        // skip whitespace and comments
+        while (pos < n && (isspace(d[pos]) || d[pos] == '#')) {
+            if (d[pos] == '#') {
+                while (pos < n && d[pos] != '\n') {
+                    pos++;
+                }
+            }
+            else {
+                pos++;
+            }
+        }
+        if (pos >= n || !isdigit(d[pos])) {
+            return false;
+        }
+        while (pos < n && isdigit(d[pos])) {
+            fields[f] = fields[f] * 10 + (d[pos] - '0');
+            if (fields[f] > 65535) {
+                return false;
+            }
+            pos++;
+        }
+    }
+    pos++; // single whitespace before the raster
+    const long w = fields[0];
+    const long h = fields[1];
+    const long maxval = fields[2];
+    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255 || pos > n) {
+        return false;
+    }
+    if (gray) {
+        if (!decodeRaw(d + pos, n - pos, w, h, RawFormat::Gray8, out)) {
+            return false;
+        }
+    }
+    else {
+        const size_t count = static_cast<size_t>(w) * h;
+        if (n - pos < count * 3) {
+            return false;
+        }
+        out.w = w;
+        out.h = h;
+        out.px.resize(count);
+        const uint8_t* src = d + pos;
+        for (size_t k = 0; k < count; ++k) {
+            out.px[k] = packBGRA(src[3 * k + 2], src[3 * k + 1], src[3 * k]);
+        }
+    }
+    if (maxval != 255) {
+        for (auto& p : out.px) {
+            const uint32_t b = (p & 0xFF) * 255 / maxval;
+            const uint32_t g = ((p >> 8) & 0xFF) * 255 / maxval;
+            const uint32_t r = ((p >> 16) & 0xFF) * 255 / maxval;
+            p = packBGRA(static_cast<uint8_t>((std::min<uint32_t>)(b, 255)),
+                static_cast<uint8_t>((std::min<uint32_t>)(g, 255)),
+                static_cast<uint8_t>((std::min<uint32_t>)(r, 255)));
+        }
+    }
+    return true;
+}
+
+bool decodeImage(const ImageSource& src, Bitmap32& out) {
+    std::vector<uint8_t> fileBytes;
+    const uint8_t* d = nullptr;
+    size_t n = 0;
+    if (src.data) {
+        d = src.data->data();
+        n = src.data->size();
+    }
+    else {
+        if (!readFileBytes(src.path, fileBytes)) {
+            return false;
+        }
+        d = fileBytes.data();
+        n = fileBytes.size();
+    }
+    if (src.rawWidth > 0) {
+        return decodeRaw(d, n, src.rawWidth, src.rawHeight, src.rawFormat, out);
+    }
+    return decodeBmp(d, n, out) || decodePpm(d, n, out);
+}
+
+// Area-average downscale of src into a dw x dh image. Each destination pixel
+// is the mean of its source block; the four channels are summed in one SSE2
+// register where available.
+void downscaleBox(const Bitmap32& src, const int dw, const int dh, Bitmap32& dst) {
+    dst.w = dw;
+    dst.h = dh;
+    dst.px.resize(static_cast<size_t>(dw) * dh);
+    std::vector<int> xs(dw + 1);
+    for (int x = 0; x <= dw; ++x) {
+        xs[x] = static_cast<int>(static_cast<int64_t>(x) * src.w / dw);
+    }
+    for (int dy = 0; dy < dh; ++dy) {
+        const int y0 = static_cast<int>(static_cast<int64_t>(dy) * src.h / dh);
+        const int y1 = (std::max)(y0 + 1, static_cast<int>(static_cast<int64_t>(dy + 1) * src.h / dh));
+        for (int dx = 0; dx < dw; ++dx) {
+            const int x0 = xs[dx];
+            const int x1 = (std::max)(x0 + 1, xs[dx + 1]);
+            uint32_t sums[4] = { 0, 0, 0, 0 };
+#ifdef XRGUI_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            __m128i acc = zero;
+            for (int y = y0; y < y1; ++y) {
+                const uint32_t* row = src.px.data() + static_cast<size_t>(y) * src.w;
+                int x = x0;
+                for (; x + 2 <= x1; x += 2) {
+                    const __m128i p16 = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + x)), zero);
+                    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(p16, zero));
+                    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(p16, zero));
+                }
+                for (; x < x1; ++x) {
+                    const __m128i p16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(row[x])), zero);
+                    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(p16, zero));
+                }
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), acc);
+#else
+            for (int y = y0; y < y1; ++y) {
+                const uint32_t* row = src.px.data() + static_cast<size_t>(y) * src.w;
+                for (int x = x0; x < x1; ++x) {
+                    sums[0] += row[x] & 0xFF;
+                    sums[1] += (row[x] >> 8) & 0xFF;
+                    sums[2] += (row[x] >> 16) & 0xFF;
+                    sums[3] += row[x] >> 24;
+                }
+            }
+#endif
+            const uint32_t count = static_cast<uint32_t>((y1 - y0) * (x1 - x0));
+            const uint32_t half = count / 2;
+            dst.px[static_cast<size_t>(dy) * dw + dx] =
+                ((sums[0] + half) / count) |
+                (((sums[1] + half) / count) << 8) |
+                (((sums[2] + half) / count) << 16) |
+                (((sums[3] + half) / count) << 24);
+        }
+    }
+}
+
+HBITMAP createDib(const Bitmap32& img) {
+    BITMAPINFO bmi;
+    memset(&bmi, 0, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = img.w;
+    bmi.bmiHeader.biHeight = -img.h; // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    void* bits = nullptr;
+    HBITMAP bmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (bmp && bits) {
+        memcpy(bits, img.px.data(), img.px.size() * 4);
+        GdiFlush();
+    }
+    return bmp;
+}
+
+struct CachedImage {
+    CachedImage() : bmp(NULL), w(0), h(0), bytes(0) {}
+    HBITMAP bmp; // NULL if decoding failed
+    int w;
+    int h;
+    size_t bytes;
+};
+
+class ImageLoader;
+// the shared loader while it exists, for resource accounting
+ImageLoader* sharedImageLoader = nullptr;
+
+class ImageLoader {
+public:
+    // Must be created on the UI thread, which owns the notification window.
+    // The cache holds at most budget bytes and maxImages images; each cached
+    // image is a GDI object, and a process has 10,000 by default.
+    ImageLoader(size_t threads, size_t budget, size_t maxImages) :
+        budgetBytes(budget),
+        usedBytes(0),
+        maxEntries(maxImages),
+        bitmapCount(0),
+        maxQueued(512),
+        stopping(false),
+        notifyPosted(false)
+    {
+        static const char* const NOTIFY_CLASS = "xrGUI_ImageLoader";
+        HINSTANCE hInstance = GetModuleHandleA(NULL);
+        WNDCLASSEXA wc;
+        if (!GetClassInfoExA(hInstance, NOTIFY_CLASS, &wc)) {
+            memset(&wc, 0, sizeof(wc));
+            wc.cbSize = sizeof(wc);
+            wc.lpfnWndProc = notifyProc;
+            wc.hInstance = hInstance;
+            wc.lpszClassName = NOTIFY_CLASS;
+            RegisterClassExA(&wc);
+        }
+        notifyWnd = CreateWindowExA(0, NOTIFY_CLASS, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+        SetWindowLongPtr(notifyWnd, GWLP_USERDATA, (LONG_PTR)this);
+        threads = (std::max<size_t>)(1, threads);
+        for (size_t k = 0; k < threads; ++k) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+    ~ImageLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) {
+            t.join();
+        }
+        if (sharedImageLoader == this) {
+            sharedImageLoader = nullptr;
+        }
+        DestroyWindow(notifyWnd);
+        for (auto& r : results) {
+            DeleteObject(r.img.bmp);
+        }
+        for (auto& e : lru) {
+            DeleteObject(e.second.bmp);
+        }
+    }
+    // Returns the cached image scaled to fit w x h, or nullptr after queuing
+    // a decode on behalf of owner. UI thread only.
+    const CachedImage* request(const ImageSource& src, const int w, const int h, const void* owner = nullptr) {
+        if (w <= 0 || h <= 0) {
+            return nullptr;
+        }
+        const std::string key = src.cacheKey() + "@" + std::to_string(w) + "x" + std::to_string(h);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return &it->second->second;
+        }
+        auto p = pending.find(key);
+        if (p != pending.end()) {
+            if (std::find(p->second.begin(), p->second.end(), owner) == p->second.end()) {
+                p->second.push_back(owner);
+            }
+            return nullptr;
+        }
+        pending[key].push_back(owner);
+        std::lock_guard<std::mutex> lock(mtx);
+        // newest requests first: they are what is on screen now
+        jobs.push_front(Job{ key, src, w, h });
+        if (jobs.size() > maxQueued) {
+            pending.erase(jobs.back().key);
+            jobs.pop_back();
+        }
+        cv.notify_one();
+        return nullptr;
+    }
+    // drop owner's decodes which have not started, e.g. after a fast
+    // scroll; decodes also requested by someone else stay queued
+    void cancelQueued(const void* owner) {
+        std::lock_guard<std::mutex> lock(mtx);
+        jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [this, owner](const Job& j) {
+            auto p = pending.find(j.key);
+            if (p == pending.end()) {
+                return true;
+            }
+            auto& owners = p->second;
+            owners.erase(std::remove(owners.begin(), owners.end(), owner), owners.end());
+            if (owners.empty()) {
+                pending.erase(p);
+                return true;
+            }
+            return false;
+        }), jobs.end());
+    }
+    void setBudget(const size_t bytes) {
+        budgetBytes = bytes;
+        evict();
+    }
+    void setMaxImages(const size_t n) {
+        maxEntries = n;
+        evict();
+    }
+    size_t cacheBytes() const {
+        return usedBytes;
+    }
+    size_t cacheCount() const {
+        return lru.size();
+    }
+    // cached DIB sections as GDI objects, their pixels as heap bytes
+    ResourceUsage getResourceUsage() const {
+        ResourceUsage u;
+        u.gdiObjects = bitmapCount;
+        u.heapBytes = usedBytes;
+        u.handles = notifyWnd ? 1 : 0;
+        return u;
+    }
+    // emitted on the UI thread when new images enter the cache
+    Signal<void()> imagesReady;
+private:
+    struct Job {
+        std::string key;
+        ImageSource src;
+        int w;
+        int h;
+    };
+    struct Finished {
+        std::string key;
+        CachedImage img;
+        bool retry; // DIB creation failed, do not cache
+    };
+    void work() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            Finished done;
+            done.key = job.key;
+            done.retry = false;
+            try {
+                done.retry = !decodeJob(job, done.img);
+            }
+            catch (...) {
+                // e.g. bad_alloc on a huge or hostile frame: report it as a
+                // failed decode rather than ending the process
+                done.img = CachedImage();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                results.push_back(done);
+            }
+            // one message per batch, collect() takes all results
+            if (!notifyPosted.exchange(true)) {
+                PostMessageA(notifyWnd, WM_APP, 0, 0);
+            }
+        }
+    }
+    // Decode and scale one job into img, leaving img.bmp NULL on failure.
+    // Returns false if only the DIB section could not be created, which is
+    // worth retrying once GDI objects have been freed.
+    static bool decodeJob(const Job& job, CachedImage& img) {
+        Bitmap32 full;
+        if (!decodeImage(job.src, full)) {
+            return true;
+        }
+        // fit inside the requested box, never upscale
+        const double scale = (std::min)(1.0, (std::min)(
+            static_cast<double>(job.w) / full.w, static_cast<double>(job.h) / full.h));
+        const int dw = (std::max)(1, static_cast<int>(full.w * scale));
+        const int dh = (std::max)(1, static_cast<int>(full.h * scale));
+        Bitmap32 scaled;
+        if (dw != full.w || dh != full.h) {
+            downscaleBox(full, dw, dh, scaled);
+        }
+        const Bitmap32& shown = scaled.px.empty() ? full : scaled;
+        img.bmp = createDib(shown);
+        if (!img.bmp) {
+            return false;
+        }
+        img.w = shown.w;
+        img.h = shown.h;
+        img.bytes = static_cast<size_t>(shown.w) * shown.h * 4;
+        return true;
+    }
+    static LRESULT CALLBACK notifyProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+        if (WM_APP == message) {
+            ImageLoader* loader = (ImageLoader*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+            if (loader) {
+                loader->collect();
+            }
+            return 0;
+        }
+        return DefWindowProcA(hWnd, message, wParam, lParam);
+    }
+    // move finished decodes into the cache, on the UI thread
+    void collect() {
+        std::vector<Finished> done;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            notifyPosted = false;
+            done.swap(results);
+        }
+        if (done.empty()) {
+            return;
+        }
+        bool outOfGdi = false;
+        for (auto& r : done) {
+            pending.erase(r.key);
+            if (r.retry) {
+                // not cached, so the next paint requests it again
+                outOfGdi = true;
+                continue;
+            }
+            if (index.count(r.key)) {
+                DeleteObject(r.img.bmp);
+                continue;
+            }
+            lru.push_front(std::make_pair(r.key, r.img));
+            index[r.key] = lru.begin();
+            usedBytes += r.img.bytes;
+            bitmapCount += r.img.bmp ? 1 : 0;
+        }
+        evict();
+        if (outOfGdi) {
+            // free the least recently drawn quarter for the retries
+            trim(lru.size() - lru.size() / 4);
+        }
+        imagesReady.emit();
+    }
+    void evict() {
+        while ((usedBytes > budgetBytes || lru.size() > maxEntries) && lru.size() > 1) {
+            trim(lru.size() - 1);
+        }
+    }
+    // drop least recently used images until at most n remain
+    void trim(const size_t n) {
+        while (lru.size() > n) {
+            auto& victim = lru.back();
+            usedBytes -= victim.second.bytes;
+            bitmapCount -= victim.second.bmp ? 1 : 0;
+            DeleteObject(victim.second.bmp);
+            index.erase(victim.first);
+            lru.pop_back();
+        }
+    }
+    // cache, touched only on the UI thread
+    std::list<std::pair<std::string, CachedImage>> lru;
+    std::unordered_map<std::string, std::list<std::pair<std::string, CachedImage>>::iterator> index;
+    // queued or running decodes and who asked for them
+    std::unordered_map<std::string, std::vector<const void*>> pending;
+    size_t budgetBytes;
+    size_t usedBytes;
+    size_t maxEntries;
+    size_t bitmapCount;
+    // shared with workers, guarded by mtx
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    std::vector<Finished> results;
+    size_t maxQueued;
+    bool stopping;
+    std::atomic<bool> notifyPosted;
+    HWND notifyWnd;
+    std::vector<std::thread> workers;
+};
+
+// shared loader, created on first use with one worker per spare core, a
+// 256 MB cache budget and at most 2,000 cached images
+ImageLoader& getImageLoader() {
+    static const unsigned int cores = std::thread::hardware_concurrency();
+    static ImageLoader loader(cores > 1 ? cores - 1 : 1, 256u * 1024 * 1024, 2000);
+    sharedImageLoader = &loader;
+    return loader;
+}
+
+// draw img centered in rc, or a placeholder frame while it is loading
+void drawCachedImage(HDC hdc, HDC memDC, const RECT& rc, const CachedImage* img) {
+    if (!img || !img->bmp) {
+        FillRect(hdc, &rc, GetSysColorBrush(COLOR_WINDOW));
+        const int cx = (rc.left + rc.right) / 2;
+        const int cy = (rc.top + rc.bottom) / 2;
+        MoveToEx(hdc, cx - 4, cy, NULL);
+        LineTo(hdc, cx + 5, cy);
+        if (img) {
+            // failed decode
+            MoveToEx(hdc, cx - 4, cy - 4, NULL);
+            LineTo(hdc, cx + 5, cy + 5);
+        }
+        return;
+    }
+    const int x = rc.left + ((rc.right - rc.left) - img->w) / 2;
+    const int y = rc.top + ((rc.bottom - rc.top) - img->h) / 2;
+    HGDIOBJ old = SelectObject(memDC, img->bmp);
+    BitBlt(hdc, x, y, img->w, img->h, memDC, 0, 0, SRCCOPY);
+    SelectObject(memDC, old);
+}
+
+class ImageView : public Window {
+public:
+    ImageView(HWND hPar, HINSTANCE hInstance) : Window(hPar), hasImage(false), waiting(false) {
+        hWnd = CreateWindowEx(
+            0,
+            "STATIC",
+            NULL,
+            WS_CHILD | WS_VISIBLE | SS_OWNERDRAW,
+            1,
+            1,
+            1,
+            1,
+            hPar,
+            id,
+            hInstance,
+            NULL);
+        readyConn = getImageLoader().imagesReady.connect([this]() {
+            if (waiting) {
+                InvalidateRect(hWnd, NULL, FALSE);
+            }
+        });
+    }
+    void setImage(const ImageSource& src) {
+        source = src;
+        hasImage = true;
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+    bool onDraw(UINT message, WPARAM wParam, LPARAM lParam) override {
+        PDRAWITEMSTRUCT pdis = (PDRAWITEMSTRUCT)lParam;
+        FillRect(pdis->hDC, &pdis->rcItem, GetSysColorBrush(COLOR_WINDOW));
+        if (!hasImage) {
+            return true;
+        }
+        const CachedImage* img = getImageLoader().request(source,
+            pdis->rcItem.right - pdis->rcItem.left, pdis->rcItem.bottom - pdis->rcItem.top, this);
+        waiting = img == nullptr;
+        HDC memDC = CreateCompatibleDC(pdis->hDC);
+        drawCachedImage(pdis->hDC, memDC, pdis->rcItem, img);
+        DeleteDC(memDC);
+        return true;
+    }
+private:
+    ImageSource source;
+    bool hasImage;
+    bool waiting;
+    ScopedConnection readyConn;
+};
+
+// Grid of thumbnails built on an owner-draw, no-data ListBox in which each
+// row holds a strip of tiles. The ListBox only sends WM_DRAWITEM for rows
+// on screen, so only visible tiles are drawn and requested from the loader.
+class ThumbnailGrid : public Window {
+public:
+    ThumbnailGrid(HWND hPar, HINSTANCE hInstance) :
+        Window(hPar),
+        tileW(128),
+        tileH(96),
+        padding(4),
+        columns(1)
+    {
+        hWnd = CreateWindowEx(
+            WS_EX_CLIENTEDGE,
+            "ListBox",
+            NULL,
+            WS_CHILD | WS_VISIBLE | WS_VSCROLL | LBS_OWNERDRAWFIXED | LBS_NODATA | LBS_NOINTEGRALHEIGHT,
+            1,
+            1,
+            1,
+            1,
+            hPar,
+            id,
+            hInstance,
+            NULL);
+        SendMessageA(hWnd, LB_SETITEMHEIGHT, 0, tileH + padding);
+        readyConn = getImageLoader().imagesReady.connect([this]() {
+            InvalidateRect(hWnd, NULL, FALSE);
+        });
+    }
+    void setTileSize(const int w, const int h) {
+        tileW = w;
+        tileH = h;
+        SendMessageA(hWnd, LB_SETITEMHEIGHT, 0, tileH + padding);
+        updateRows();
+    }
+    void setImages(const std::vector<ImageSource>& srcs) {
+        // queued decodes for the previous set are no longer useful
+        getImageLoader().cancelQueued(this);
+        sources = srcs;
+        updateRows();
+    }
+    void addImage(const ImageSource& src) {
+        sources.push_back(src);
+        updateRows();
+    }
+    bool setPosition(XYWH pos) override {
+        Window::setPosition(pos);
+        updateRows();
+        return true;
+    }
+    bool onWindowMessage(UINT message, WPARAM wParam, LPARAM lParam, LRESULT& result) override {
+        if (WM_LBUTTONDOWN != message) {
+            return false;
+        }
+        // hit-test before the ListBox handles the click, which may scroll
+        const size_t idx = tileAt((short)LOWORD(lParam), (short)HIWORD(lParam));
+        result = DefSubclassProc(hWnd, message, wParam, lParam);
+        if (idx < sources.size()) {
+            tileClicked.emit(idx);
+        }
+        return true;
+    }
+    bool onDraw(UINT message, WPARAM wParam, LPARAM lParam) override {
+        PDRAWITEMSTRUCT pdis = (PDRAWITEMSTRUCT)lParam;
+        if (pdis->itemID == -1) { return true; }
+        FillRect(pdis->hDC, &pdis->rcItem, GetSysColorBrush(COLOR_WINDOW));
+        HDC memDC = CreateCompatibleDC(pdis->hDC);
+        ImageLoader& loader = getImageLoader();
+        for (size_t c = 0; c < columns; ++c) {
+            const size_t idx = static_cast<size_t>(pdis->itemID) * columns + c;
+            if (idx >= sources.size()) {
+                break;
+            }
+            RECT tile;
+            tile.left = pdis->rcItem.left + static_cast<LONG>(c) * (tileW + padding) + padding / 2;
+            tile.top = pdis->rcItem.top + padding / 2;
+            tile.right = tile.left + tileW;
+            tile.bottom = tile.top + tileH;
+            drawCachedImage(pdis->hDC, memDC, tile, loader.request(sources[idx], tileW, tileH, this));
+        }
+        DeleteDC(memDC);
+        return true;
+    }
+    ResourceUsage getResourceUsage() const override {
+        ResourceUsage u = Window::getResourceUsage();
+        u.heapBytes += sources.capacity() * sizeof(ImageSource);
+        return u;
+    }
+    // emitted with the image index when a tile is clicked
+    Signal<void(size_t)> tileClicked;
+    std::vector<ImageSource> sources;
+private:
+    // image index under a client point, or sources.size() if none
+    size_t tileAt(const int x, const int y) const {
+        const LRESULT hit = SendMessageA(hWnd, LB_ITEMFROMPOINT, 0, MAKELPARAM(x, y));
+        if (HIWORD(hit) != 0 || x < 0) {
+            return sources.size(); // outside the client area
+        }
+        const size_t row = LOWORD(hit);
+        const size_t col = static_cast<size_t>(x) / (tileW + padding);
+        const size_t idx = row * columns + col;
+        return col < columns && idx < sources.size() ? idx : sources.size();
+    }
+    void updateRows() {
+        RECT rc;
+        GetClientRect(hWnd, &rc);
+        columns = (std::max<size_t>)(1, static_cast<size_t>(rc.right - rc.left) / (tileW + padding));
+        const size_t rows = (sources.size() + columns - 1) / columns;
+        SendMessageA(hWnd, LB_SETCOUNT, rows, 0);
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+    int tileW;
+    int tileH;
+    int padding;
+    size_t columns;
+    ScopedConnection readyConn;
+};
+
+// Item returned by a TreeView child provider.
+struct TreeItem {
+    TreeItem(const std::string& l, uint64_t k, bool children) :
+        label(l), key(k), hasChildren(children)
+    {}
+    std::string label;
+    uint64_t key;
+    bool hasChildren;
+};
+
+// Tree built on an owner-draw, no-data ListBox. Nodes live in one flat
+// array with their labels packed into a shared character pool, and a node's
+// children are fetched from the provider the first time it is expanded and
+// stored contiguously. The ListBox holds one row per visible node and only
+// draws rows on screen. Double-click a row, or click its +/- box, to toggle;
+// Right and Left expand and collapse the selected row.
+class TreeView : public Window {
+public:
+    using F_CHILDREN = std::function<void(uint64_t key, std::vector<TreeItem>& children)>;
+
+    TreeView(HWND hPar, HINSTANCE hInstance) :
+        Window(hPar),
+        rowHeight(18),
+        indent(16)
+    {
+        hWnd = CreateWindowEx(
+            WS_EX_CLIENTEDGE,
+            "ListBox",
+            NULL,
+            WS_CHILD | WS_VISIBLE | WS_VSCROLL | LBS_OWNERDRAWFIXED | LBS_NODATA | LBS_NOINTEGRALHEIGHT | LBS_NOTIFY,
+            1,
+            1,
+            1,
+            1,
+            hPar,
+            id,
+            hInstance,
+            NULL);
+        SendMessageA(hWnd, LB_SETITEMHEIGHT, 0, rowHeight);
+    }
+    // called with a node's key the first time it is expanded
+    void setChildProvider(F_CHILDREN f) {
+        provider = f;
+    }
+    void setRoots(const std::vector<TreeItem>& roots) {
+        nodes.clear();
+        labelPool.clear();
+        visible.clear();
+        for (auto& item : roots) {
+            visible.push_back(addNode(item, NO_PARENT, 0));
+        }
+        updateRows(0, LB_ERR);
+    }
+    size_t rowCount() const {
+        return visible.size();
+    }
+    uint64_t keyOfRow(const size_t row) const {
+        return nodes[visible[row]].key;
+    }
+    bool isExpanded(const size_t row) const {
+        return (nodes[visible[row]].flags & EXPANDED) != 0;
+    }
+    void expandRow(const size_t row) {
+        if (row >= visible.size()) {
+            return;
+        }
+        const uint32_t n = visible[row];
+        if (!(nodes[n].flags & HAS_CHILDREN) || (nodes[n].flags & EXPANDED)) {
+            return;
+        }
+        if (!(nodes[n].flags & LOADED)) {
+            loadChildren(n);
+        }
+        nodes[n].flags |= EXPANDED;
+        // children, plus the subtrees of children left expanded earlier
+        std::vector<uint32_t> rows;
+        rows.reserve(nodes[n].childCount);
+        appendVisibleChildren(n, rows);
+        const LRESULT top = SendMessageA(hWnd, LB_GETTOPINDEX, 0, 0);
+        LRESULT sel = SendMessageA(hWnd, LB_GETCURSEL, 0, 0);
+        if (sel > static_cast<LRESULT>(row)) {
+            sel += rows.size();
+        }
+        visible.insert(visible.begin() + row + 1, rows.begin(), rows.end());
+        updateRows(top, sel);
+        expanded.emit(nodes[n].key);
+    }
+    void collapseRow(const size_t row) {
+        if (row >= visible.size()) {
+            return;
+        }
+        const uint32_t n = visible[row];
+        if (!(nodes[n].flags & EXPANDED)) {
+            return;
+        }
+        nodes[n].flags &= ~EXPANDED;
+        size_t end = row + 1;
+        while (end < visible.size() && nodes[visible[end]].depth > nodes[n].depth) {
+            end++;
+        }
+        const LRESULT top = SendMessageA(hWnd, LB_GETTOPINDEX, 0, 0);
+        LRESULT sel = SendMessageA(hWnd, LB_GETCURSEL, 0, 0);
+        // a selected row that is hidden passes the selection to this one
+        const bool selHidden = sel > static_cast<LRESULT>(row) && sel < static_cast<LRESULT>(end);
+        if (selHidden) {
+            sel = row;
+        }
+        else if (sel >= static_cast<LRESULT>(end)) {
+            sel -= end - row - 1;
+        }
+        visible.erase(visible.begin() + row + 1, visible.begin() + end);
+        updateRows((std::min)(static_cast<size_t>(top), row), sel);
+        collapsed.emit(nodes[n].key);
+        if (selHidden) {
+            selectionChanged.emit(nodes[n].key);
+        }
+    }
+    void toggleRow(const size_t row) {
+        if (row >= visible.size()) {
+            return;
+        }
+        if (isExpanded(row)) {
+            collapseRow(row);
+        }
+        else {
+            expandRow(row);
+        }
+    }
+    bool onCommand(UINT message, WPARAM wParam, LPARAM lParam) override {
+        const LRESULT row = SendMessageA(hWnd, LB_GETCURSEL, 0, 0);
+        if (row < 0 || static_cast<size_t>(row) >= visible.size()) {
+            return true;
+        }
+        if (HIWORD(wParam) == LBN_DBLCLK) {
+            toggleRow(row);
+        }
+        else if (HIWORD(wParam) == LBN_SELCHANGE) {
+            selectionChanged.emit(nodes[visible[row]].key);
+        }
+        return true;
+    }
+    bool onWindowMessage(UINT message, WPARAM wParam, LPARAM lParam, LRESULT& result) override {
+        if (WM_LBUTTONDOWN == message || WM_LBUTTONDBLCLK == message) {
+            const size_t row = boxAt((short)LOWORD(lParam), (short)HIWORD(lParam));
+            if (row >= visible.size()) {
+                return false;
+            }
+            // the press toggles; the second press of a double-click is
+            // swallowed so the box does not toggle back
+            if (WM_LBUTTONDOWN == message) {
+                toggleRow(row);
+            }
+            result = 0;
+            return true;
+        }
+        if (WM_KEYDOWN == message && (VK_RIGHT == wParam || VK_LEFT == wParam)) {
+            const LRESULT row = SendMessageA(hWnd, LB_GETCURSEL, 0, 0);
+            if (row < 0 || static_cast<size_t>(row) >= visible.size()) {
+                return false;
+            }
+            if (VK_RIGHT == wParam) {
+                expandRow(row);
+            }
+            else {
+                collapseRow(row);
+            }
+            result = 0;
+            return true;
+        }
+        return false;
+    }
+    bool onDraw(UINT message, WPARAM wParam, LPARAM lParam) override {
+        PDRAWITEMSTRUCT pdis = (PDRAWITEMSTRUCT)lParam;
+        if (pdis->itemID == -1 || pdis->itemID >= visible.size()) { return true; }
+        const TreeNode& node = nodes[visible[pdis->itemID]];
+        const bool selected = (pdis->itemState & ODS_SELECTED) != 0;
+        FillRect(pdis->hDC, &pdis->rcItem, GetSysColorBrush(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+        SetBkMode(pdis->hDC, TRANSPARENT);
+        SetTextColor(pdis->hDC, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
+
+        const int x = pdis->rcItem.left + node.depth * indent;
+        const int cy = (pdis->rcItem.top + pdis->rcItem.bottom) / 2;
+        if (node.flags & HAS_CHILDREN) {
+            // +/- box
+            const int bx = x + indent / 2;
+            Rectangle(pdis->hDC, bx - 4, cy - 4, bx + 5, cy + 5);
+            MoveToEx(pdis->hDC, bx - 2, cy, NULL);
+            LineTo(pdis->hDC, bx + 3, cy);
+            if (!(node.flags & EXPANDED)) {
+                MoveToEx(pdis->hDC, bx, cy - 2, NULL);
+                LineTo(pdis->hDC, bx, cy + 3);
+            }
+        }
+        TEXTMETRICA tm;
+        GetTextMetricsA(pdis->hDC, &tm);
+        const int yPos = (pdis->rcItem.bottom + pdis->rcItem.top - tm.tmHeight) / 2;
+        TextOutA(pdis->hDC, x + indent + 2, yPos, labelPool.data() + node.labelOffset, node.labelLength);
+        if (pdis->itemState & ODS_FOCUS) {
+            DrawFocusRect(pdis->hDC, &pdis->rcItem);
+        }
+        return true;
+    }
+    ResourceUsage getResourceUsage() const override {
+        ResourceUsage u = Window::getResourceUsage();
+        u.heapBytes += nodes.capacity() * sizeof(TreeNode) + labelPool.capacity() +
+            visible.capacity() * sizeof(uint32_t) + scratch.capacity() * sizeof(TreeItem);
+        return u;
+    }
+    // emitted with the node key
+    Signal<void(uint64_t)> selectionChanged;
+    Signal<void(uint64_t)> expanded;
+    Signal<void(uint64_t)> collapsed;
+private:
+    enum : uint8_t {
+        HAS_CHILDREN = 1,
+        EXPANDED = 2,
+        LOADED = 4
+    };
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+    struct TreeNode {
+        uint64_t key;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t childCount;
+        uint32_t labelOffset;
+        uint32_t labelLength;
+        uint16_t depth;
+        uint8_t flags;
+    };
+    uint32_t addNode(const TreeItem& item, const uint32_t parent, const uint16_t depth) {
+        TreeNode node;
+        node.key = item.key;
+        node.parent = parent;
+        node.firstChild = 0;
+        node.childCount = 0;
+        node.labelOffset = static_cast<uint32_t>(labelPool.size());
+        node.labelLength = static_cast<uint32_t>(item.label.size());
+        node.depth = depth;
+        node.flags = item.hasChildren ? HAS_CHILDREN : 0;
+        labelPool.insert(labelPool.end(), item.label.begin(), item.label.end());
+        nodes.push_back(node);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+    void loadChildren(const uint32_t n) {
+        scratch.clear();
+        if (provider) {
+            provider(nodes[n].key, scratch);
+        }
+        const uint32_t first = static_cast<uint32_t>(nodes.size());
+        const uint16_t depth = nodes[n].depth + 1;
+        // grow geometrically, an exact reserve would copy every node on
+        // each expand
+        if (nodes.size() + scratch.size() > nodes.capacity()) {
+            nodes.reserve((std::max)(nodes.size() + scratch.size(), 2 * nodes.capacity()));
+        }
+        for (auto& item : scratch) {
+            addNode(item, n, depth);
+        }
+        nodes[n].firstChild = first;
+        nodes[n].childCount = static_cast<uint32_t>(scratch.size());
+        nodes[n].flags |= LOADED;
+        if (scratch.empty()) {
+            nodes[n].flags &= ~HAS_CHILDREN;
+        }
+        // keep the buffer, drop the label allocations
+        scratch.clear();
+    }
+    // row whose +/- box contains the client point, or visible.size()
+    size_t boxAt(const int x, const int y) const {
+        // rows have a fixed height; LB_ITEMFROMPOINT only reports 16 bit
+        // indices, too few for large trees
+        RECT rc;
+        GetClientRect(hWnd, &rc);
+        if (y < 0 || y >= rc.bottom) {
+            return visible.size();
+        }
+        const LRESULT top = SendMessageA(hWnd, LB_GETTOPINDEX, 0, 0);
+        const size_t row = static_cast<size_t>((std::max<LRESULT>)(0, top)) + y / rowHeight;
+        if (row >= visible.size()) {
+            return visible.size();
+        }
+        const TreeNode& node = nodes[visible[row]];
+        const int boxLeft = node.depth * indent;
+        if (!(node.flags & HAS_CHILDREN) || x < boxLeft || x >= boxLeft + indent) {
+            return visible.size();
+        }
+        return row;
+    }
+    void appendVisibleChildren(const uint32_t n, std::vector<uint32_t>& rows) const {
+        const uint32_t end = nodes[n].firstChild + nodes[n].childCount;
+        for (uint32_t c = nodes[n].firstChild; c < end; ++c) {
+            rows.push_back(c);
+            if (nodes[c].flags & EXPANDED) {
+                appendVisibleChildren(c, rows);
+            }
+        }
+    }
+    // resize the list box and restore the scroll position and selection,
+    // which LB_SETCOUNT resets; sel is the selected row after the change
+    void updateRows(const LRESULT top, const LRESULT sel) {
+        SendMessageA(hWnd, LB_SETCOUNT, visible.size(), 0);
+        if (top > 0) {
+            SendMessageA(hWnd, LB_SETTOPINDEX, top, 0);
+        }
+        if (sel >= 0) {
+            SendMessageA(hWnd, LB_SETCURSEL, sel, 0);
+        }
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+    std::vector<TreeNode> nodes;
+    std::vector<char> labelPool;
+    // node index of each displayed row
+    std::vector<uint32_t> visible;
+    std::vector<TreeItem> scratch;
+    F_CHILDREN provider;
+    int rowHeight;
+    int indent;
+};
+
+// Process wide resource snapshot of all registered windows.
+struct WindowResourceEntry {
+    HMENU id;
+    HWND hWnd;
+    std::string type;
+    ResourceUsage usage;
+};
+
+struct ResourceSnapshot {
+    std::vector<WindowResourceEntry> windows;
+    // DIB sections held by the shared image cache, not owned by any window
+    ResourceUsage imageCache;
+    ResourceUsage total;
+    // as reported by the system for the whole process, including objects
+    // not owned by any xrGUI window
+    DWORD processGdiObjects;
+    DWORD processUserObjects;
+};
+
+ResourceSnapshot getResourceSnapshot() {
+    ResourceSnapshot snap;
+    snap.windows.reserve(windowMap.size());
+    for (auto& w : windowMap) {
+        WindowResourceEntry e;
+        e.id = w.first;
+        e.hWnd = w.second->hWnd;
+        e.type = typeid(*w.second).name();
+        e.usage = w.second->getResourceUsage();
+        snap.total += e.usage;
+        snap.windows.push_back(e);
+    }
+    if (sharedImageLoader) {
+        snap.imageCache = sharedImageLoader->getResourceUsage();
+        snap.total += snap.imageCache;
+    }
+    snap.processGdiObjects = GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+    snap.processUserObjects = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+    return snap;
+}
+
+std::string formatResourceSnapshot(const ResourceSnapshot& snap) {
+    std::string out = "xrGUI resources: " + std::to_string(snap.windows.size()) + " windows, " +
+        std::to_string(snap.total.gdiObjects) + " GDI objects, " +
+        std::to_string(snap.total.handles) + " handles, " +
+        std::to_string(snap.total.heapBytes) + " heap bytes (process: " +
+        std::to_string(snap.processGdiObjects) + " GDI, " +
+        std::to_string(snap.processUserObjects) + " USER)\n";
+    for (auto& e : snap.windows) {
+        out += "  " + e.type + " id " + std::to_string((UINT_PTR)e.id) + ": " +
+            std::to_string(e.usage.gdiObjects) + " GDI, " +
+            std::to_string(e.usage.handles) + " handles, " +
+            std::to_string(e.usage.heapBytes) + " bytes\n";
+    }
+    out += "  image cache: " + std::to_string(snap.imageCache.gdiObjects) + " GDI, " +
+        std::to_string(snap.imageCache.handles) + " handles, " +
+        std::to_string(snap.imageCache.heapBytes) + " bytes\n";
+    return out;
+}
+
+void dumpResourceSnapshot() {
+    OutputDebugStringA(formatResourceSnapshot(getResourceSnapshot()).c_str());
+}
+
+// periodically write a snapshot to the debugger output while run() is
+// active; returns a timer id for cancelTimer
+int enableResourceDump(const unsigned int ms) {
+    return addTimer(ms, &dumpResourceSnapshot);
+}
+
 } // namespace
@@ -0,0 +1,183 @@
+// xrGUI_Bench.cpp : Micro benchmarks for xrGUI building blocks. Windows are
+// created hidden and messages are dispatched directly, so no message loop
+// runs. Build as a console application with GUI.hpp on the include path, in
+// Release.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "GUI.hpp"
+
+using BenchClock = std::chrono::steady_clock;
+
+static double elapsedNs(BenchClock::time_point start) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        BenchClock::now() - start).count());
+}
+
+// cost of Signal::emit with 1, 8 and 64 connected slots
+void benchSignalEmit() {
+    const int EMITS = 1000000;
+    const size_t counts[] = { 1, 8, 64 };
+    for (auto subscribers : counts) {
+        xrGUI::Signal<void(int)> sig;
+        std::vector<xrGUI::ScopedConnection> conns;
+        volatile int sink = 0;
+        for (size_t k = 0; k < subscribers; ++k) {
+            conns.emplace_back(sig.connect([&sink](int x) { sink = sink + x; }));
+        }
+        const auto start = BenchClock::now();
+        for (int k = 0; k < EMITS; ++k) {
+            sig.emit(k);
+        }
+        const double ns = elapsedNs(start);
+        printf("signal emit, %3zu subscribers: %8.1f ns/emit, %6.2f ns/slot\n",
+            subscribers, ns / EMITS, ns / EMITS / subscribers);
+    }
+}
+
+// full re-sort of a 5M row ListBox index, by an integer key and by a bool key
+void benchListBoxResort() {
+    const size_t ROWS = 5000000;
+    std::vector<xrGUI::LBString> rows;
+    rows.reserve(ROWS);
+    uint32_t seed = 12345;
+    for (size_t k = 0; k < ROWS; ++k) {
+        seed = seed * 1664525u + 1013904223u;
+        rows.emplace_back(std::to_string(seed));
+    }
+    std::vector<uint32_t> order;
+
+    xrGUI::KeyedSortIndex<unsigned long> byValue(
+        [](const xrGUI::LBString& s) { return std::stoul(s.str); }, true);
+    auto start = BenchClock::now();
+    byValue.sort(rows, order);
+    printf("re-sort %zu rows by integer key: %8.1f ms\n", ROWS, elapsedNs(start) / 1e6);
+
+    xrGUI::KeyedSortIndex<bool> byParity(
+        [](const xrGUI::LBString& s) { return (s.str.back() - '0') % 2 == 0; }, false);
+    start = BenchClock::now();
+    byParity.sort(rows, order);
+    printf("re-sort %zu rows by bool key:    %8.1f ms\n", ROWS, elapsedNs(start) / 1e6);
+}
+
+// open a menu whose 5,000 items are generated by its populate callback
+void benchMenuPopulate() {
+    const int ITEMS = 5000;
+    const int OPENS = 20;
+    xrGUI::Menu menu;
+    menu.setPopulateCallback([ITEMS](xrGUI::Menu& m) {
+        m.reserve(ITEMS);
+        for (int k = 0; k < ITEMS; ++k) {
+            m.addTextItem("Item " + std::to_string(k));
+        }
+    });
+    int clicks = 0;
+    menu.setItemCallback([&clicks](int) { clicks++; });
+    double ns = 0;
+    for (int k = 0; k < OPENS; ++k) {
+        menu.invalidate();
+        const auto start = BenchClock::now();
+        menu.onInitMenuPopup();
+        ns += elapsedNs(start);
+    }
+    printf("menu populate, %d items: %8.2f ms/open\n", ITEMS, ns / OPENS / 1e6);
+    DestroyMenu((HMENU)menu.hWnd);
+}
+
+// eight buttons declared as a WindowTree
+template <int Id>
+struct BenchButton : xrGUI::ControlDesc<xrGUI::Button, Id> {};
+using BenchTree = xrGUI::WindowTree<BenchButton<1>, BenchButton<2>, BenchButton<3>, BenchButton<4>,
+    BenchButton<5>, BenchButton<6>, BenchButton<7>, BenchButton<8>>;
+
+// creating eight buttons as a WindowTree and one by one with makeWindow,
+// then routing WM_COMMAND to one of them
+void benchWindowTree() {
+    const int SCREENS = 200;
+    const int COMMANDS = 1000000;
+    HINSTANCE hInstance = GetModuleHandleA(NULL);
+    double treeNs = 0;
+    double singleNs = 0;
+    for (int k = 0; k < SCREENS; ++k) {
+        std::shared_ptr<xrGUI::Window> parent = std::make_shared<xrGUI::Static>((HWND)NULL);
+        parent->hWnd = CreateWindowExA(0, "STATIC", NULL, WS_OVERLAPPEDWINDOW, 0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+        auto start = BenchClock::now();
+        auto tree = BenchTree::create(parent, hInstance);
+        treeNs += elapsedNs(start);
+        start = BenchClock::now();
+        for (int c = 0; c < 8; ++c) {
+            xrGUI::makeWindow<xrGUI::Button>(parent);
+        }
+        singleNs += elapsedNs(start);
+        DestroyWindow(parent->hWnd);
+    }
+    printf("create 8 buttons, WindowTree: %8.1f us, makeWindow: %8.1f us\n",
+        treeNs / SCREENS / 1e3, singleNs / SCREENS / 1e3);
+
+    std::shared_ptr<xrGUI::Window> parent = std::make_shared<xrGUI::Static>((HWND)NULL);
+    parent->hWnd = CreateWindowExA(0, "STATIC", NULL, WS_OVERLAPPEDWINDOW, 0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+    auto tree = BenchTree::create(parent, hInstance);
+    auto single = xrGUI::makeWindow<xrGUI::Button>(parent);
+    int clicks = 0;
+    tree->get<BenchButton<5>>().setClickCallback([&clicks]() { clicks++; });
+    single->setClickCallback([&clicks]() { clicks++; });
+    const xrGUI::Window* targets[] = { &tree->get<BenchButton<5>>(), single.get() };
+    const char* names[] = { "WindowTree", "makeWindow" };
+    for (int t = 0; t < 2; ++t) {
+        const WPARAM wParam = MAKEWPARAM((UINT_PTR)targets[t]->id, BN_CLICKED);
+        const LPARAM lParam = (LPARAM)targets[t]->hWnd;
+        const auto start = BenchClock::now();
+        for (int k = 0; k < COMMANDS; ++k) {
+            xrGUI::handleWinMessage(parent->hWnd, WM_COMMAND, wParam, lParam);
+        }
+        printf("WM_COMMAND dispatch, %s: %8.1f ns\n", names[t], elapsedNs(start) / COMMANDS);
+    }
+    DestroyWindow(parent->hWnd);
+}
+
+// TreeView: expand and collapse a node with 100,000 children, then expand
+// 1,000 nodes of 1,000 children one by one to grow a 1M node tree
+void benchTreeView() {
+    HINSTANCE hInstance = GetModuleHandleA(NULL);
+    HWND parent = CreateWindowExA(0, "STATIC", NULL, WS_OVERLAPPEDWINDOW, 0, 0, 400, 400, NULL, NULL, hInstance, NULL);
+    xrGUI::TreeView tree(parent, hInstance);
+    tree.setChildProvider([](uint64_t key, std::vector<xrGUI::TreeItem>& out) {
+        const size_t n = key == 0 ? 100000 : 1000;
+        for (size_t k = 0; k < n; ++k) {
+            out.emplace_back("node " + std::to_string(k), key * 100000 + k + 1, key == 0);
+        }
+    });
+    tree.setRoots({ xrGUI::TreeItem("root", 0, true) });
+    auto start = BenchClock::now();
+    tree.expandRow(0);
+    printf("tree expand 100,000 children:   %8.2f ms\n", elapsedNs(start) / 1e6);
+    start = BenchClock::now();
+    tree.collapseRow(0);
+    printf("tree collapse 100,000 children: %8.2f ms\n", elapsedNs(start) / 1e6);
+    start = BenchClock::now();
+    tree.expandRow(0);
+    printf("tree re-expand (loaded):        %8.2f ms\n", elapsedNs(start) / 1e6);
+
+    const size_t EXPANDS = 1000;
+    start = BenchClock::now();
+    for (size_t k = 0; k < EXPANDS; ++k) {
+        // row of the k-th child of the root, after the children expanded so far
+        tree.expandRow(1 + k * 1001);
+    }
+    printf("tree expand %zu nodes one by one: %8.2f ms total, %zu rows\n",
+        EXPANDS, elapsedNs(start) / 1e6, tree.rowCount());
+    DestroyWindow(parent);
+}
+
+int main() {
+    benchSignalEmit();
+    benchListBoxResort();
+    benchMenuPopulate();
+    benchWindowTree();
+    benchTreeView();
+    return 0;
+}
@@ -17,8 +17,22 @@ struct GUIHandles {
     std::shared_ptr<xrGUI::ComboBox> combobox1;
     std::shared_ptr<xrGUI::EditBox> editbox1;
     std::shared_ptr<xrGUI::Button> button1;
+    std::shared_ptr<xrGUI::Observable<std::string>> buttonText;
 };
 
+// Controls created from a compile-time description
+struct Label1Desc : xrGUI::ControlDesc<xrGUI::Static, 1> {
+    static constexpr const char* text = "Listbox 1";
+    static constexpr const char* font = "Arial";
+    static constexpr long fontSize = 11;
+};
+struct Label2Desc : xrGUI::ControlDesc<xrGUI::Static, 2> {
+    static constexpr const char* text = "Listbox 2";
+    static constexpr const char* font = "Arial";
+    static constexpr long fontSize = 11;
+};
+using LabelTree = xrGUI::WindowTree<Label1Desc, Label2Desc>;
+
 // Global Variables:
 HINSTANCE hInst;                                // current instance
 
@@ -45,18 +59,8 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance,
         return FALSE;
     }
 
-    MSG msg;
-
     // Main message loop
-    while (GetMessage(&msg, nullptr, 0, 0) > 0)
-    {
-        {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
-    }
-
-    return (int) msg.wParam;
+    return xrGUI::run();
 }
 
 void onFoobar() {
@@ -120,17 +124,26 @@ void createGUI(HINSTANCE hInstance) {
 
     menuView->setClickCallback(waterfallId, &onFoobar);
 
+    // submenu filled on demand each time it is invalidated
+    auto menuRecent = xrGUI::makeWindow<xrGUI::Menu>();
+    menuView->addSubMenu(menuRecent, "Recent");
+    menuRecent->setPopulateCallback([](xrGUI::Menu& m) {
+        m.reserve(5);
+        for (int k = 0; k < 5; ++k) {
+            m.addTextItem("Recent " + std::to_string(k + 1));
+        }
+    });
+    menuRecent->setItemCallback([](int idx) {
+        // recent item callback - put code here
+    });
+
     handles.mainWindow = xrGUI::makeWindow< xrGUI::MainWindow >(hInstance, "MainWindow", "My Window", (HMENU)menuBar->hWnd);
     handles.mainWindow->setResizeCallback(&onResizeMainWindow);
     handles.mainWindow->setDestroyCallback(&onCloseMainWindow);
 
-    handles.label1 = xrGUI::makeWindow<xrGUI::Static>(handles.mainWindow->hWnd);
-    handles.label1->setText("Listbox 1");
-    handles.label1->setFont("Arial", 11);
-
-    handles.label2 = xrGUI::makeWindow<xrGUI::Static>(handles.mainWindow->hWnd);
-    handles.label2->setText("Listbox 2");
-    handles.label2->setFont("Arial", 11);
+    auto labels = LabelTree::create(handles.mainWindow, hInstance);
+    handles.label1 = labels->share<Label1Desc>();
+    handles.label2 = labels->share<Label2Desc>();
 
     handles.listbox1 = xrGUI::makeWindow<xrGUI::ListBox>(handles.mainWindow->hWnd, hInstance);
     handles.listbox1->setFont("Consolas", 12);
@@ -152,7 +165,8 @@ void createGUI(HINSTANCE hInstance) {
     handles.editbox1->setClickCallback(&onChangeEditBox);
 
     handles.button1 = xrGUI::makeWindow<xrGUI::Button>(handles.mainWindow->hWnd);
-    handles.button1->setText("A B C");
+    handles.buttonText = std::make_shared<xrGUI::Observable<std::string>>("A B C");
+    handles.button1->bindText(handles.buttonText);
     handles.button1->setClickCallback(&onChangeEditBox);
 
 }